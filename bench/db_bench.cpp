@@ -0,0 +1,134 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include <benchmark/benchmark.h>
+
+#include "hash_delimeter.hpp"
+#include "tokenizer.hpp"
+#include "phash.hpp"
+#include "hashes_db.hpp"
+#include "exc.hpp"
+
+using namespace imgdupl;
+
+// Lines of imghash text output: a hash and a path separated by a tab.
+static std::vector<std::string>
+make_lines(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<std::string> lines;
+
+    for (size_t i = 0; i < count; i++) {
+        std::string line;
+
+        for (size_t w = 0; w < PHash().size(); w++) {
+            if (w > 0) {
+                line += HASH_PRINT_DELIMETER;
+            }
+            line += std::to_string(rng());
+        }
+
+        line += "\t/data/images/" + std::to_string(rng() % 1000) + "/" + std::to_string(i) + ".jpg";
+        lines.push_back(line);
+    }
+
+    return lines;
+}
+
+static void
+BM_MakeHash(benchmark::State& state)
+{
+    auto lines = make_lines(1024, 1);
+
+    std::vector<std::string> hashes;
+    for (auto& line : lines) {
+        hashes.push_back(line.substr(0, line.find('\t')));
+    }
+
+    size_t i = 0;
+
+    for (auto _ : state) {
+        PHash hash = make_hash(hashes[i++ % hashes.size()]);
+        benchmark::DoNotOptimize(hash);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_MakeHash);
+
+static void
+BM_DecodeHashBlob(benchmark::State& state)
+{
+    std::mt19937_64 rng(1);
+    std::vector<uint8_t> blobs(1024 * PHASH_BLOB_SIZE);
+
+    for (auto& v : blobs) {
+        v = rng();
+    }
+
+    size_t i = 0;
+
+    for (auto _ : state) {
+        PHash hash = decode_hash_blob(blobs.data() + i++ % 1024 * PHASH_BLOB_SIZE, PHASH_BLOB_SIZE);
+        benchmark::DoNotOptimize(hash);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_DecodeHashBlob);
+
+// export2db hashes: parsing of text lines and inserts into a new database in
+// one transaction, like fill_hashes_db() does.
+static void
+BM_ExportHashes(benchmark::State& state)
+{
+    auto lines = make_lines(state.range(0), 1);
+    std::string path = "/tmp/imgdupl-bench-" + std::to_string(getpid()) + ".db";
+
+    Tokens tokens;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+
+        unlink(path.c_str());
+
+        sqlite3* db = NULL;
+        int rc = sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+        THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+
+        create_hashes_table(db);
+
+        state.ResumeTiming();
+
+        {
+            HashesInserter inserter(db);
+
+            sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+
+            for (auto& line : lines) {
+                tokenize(line, tokens, "\t");
+                inserter.insert(make_hash(tokens[0]), tokens[1]);
+            }
+
+            sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+        }
+
+        state.PauseTiming();
+        sqlite3_close(db);
+        state.ResumeTiming();
+    }
+
+    unlink(path.c_str());
+
+    state.SetItemsProcessed(state.iterations() * lines.size());
+}
+
+BENCHMARK(BM_ExportHashes)->Arg(100000)->Unit(benchmark::kMillisecond);
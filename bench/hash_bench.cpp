@@ -0,0 +1,168 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "dct_perceptual_hasher.hpp"
+#include "image_hash.hpp"
+#include "hasher_registry.hpp"
+
+using namespace imgdupl;
+
+static void
+init_magick()
+{
+    static bool initialized = false;
+
+    if (!initialized) {
+        Magick::InitializeMagick(nullptr);
+        initialized = true;
+    }
+}
+
+// Synthetic photo-like image, plasma fractal has smooth gradients and fine
+// details both, so hashes and decoders get something like real data.
+static Magick::Image
+make_image(size_t width, size_t height)
+{
+    init_magick();
+
+    Magick::Image image;
+
+    image.size(Magick::Geometry(width, height));
+    image.read("plasma:fractal");
+
+    return image;
+}
+
+// A hash of an image which is already decoded: grayscale conversion, resize
+// to NxN, DCT and the median.
+template <int N, int Bits>
+static void
+BM_DCTHash(benchmark::State& state)
+{
+    DCTHasher<N, Bits> hasher;
+    Magick::Image image = make_image(state.range(0), state.range(0) * 3 / 4);
+
+    for (auto _ : state) {
+        auto hash = hasher.hash(image);
+        benchmark::DoNotOptimize(hash);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_DCTHash, 32, 64)->Arg(64)->Arg(640)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_DCTHash, 50, 128)->Arg(64)->Arg(640)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_DCTHash, 64, 256)->Arg(64)->Arg(640)->Unit(benchmark::kMicrosecond);
+
+// hash_batch() on images which are downscaled already, the part of hashing
+// which doesn't depend on decoders. Batches of one show what batching gives.
+template <typename Pixel>
+static void
+BM_HashBatch(benchmark::State& state)
+{
+    const size_t count = state.range(0);
+    const int n = DCTHasher<50, PHASH_BITS>::size;
+
+    DCTHasher<50, PHASH_BITS> hasher;
+
+    std::mt19937 rng(1);
+    std::vector<Pixel> pixels(count * n * n);
+    for (auto& v : pixels) {
+        v = rng() % 256;
+    }
+
+    std::vector<PHash> hashes(count);
+
+    for (auto _ : state) {
+        hasher.hash_batch(pixels.data(), count, hashes.data());
+        benchmark::DoNotOptimize(hashes.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+BENCHMARK_TEMPLATE(BM_HashBatch, float)->Arg(1)->Arg(16)->Arg(256)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_HashBatch, uint8_t)->Arg(1)->Arg(16)->Arg(256)->Unit(benchmark::kMicrosecond);
+
+// Every algorithm imghash --algo offers, through the registry as imghash
+// calls them, on batches of already downscaled images.
+static void
+BM_RegisteredHasher(benchmark::State& state)
+{
+    const size_t count = 256;
+
+    auto hasher = make_hasher(hasher_names()[state.range(0)]);
+
+    std::mt19937 rng(1);
+    std::vector<float> pixels(count * hasher->pixels());
+    for (auto& v : pixels) {
+        v = rng() % 256;
+    }
+
+    std::vector<PHash> hashes(count);
+
+    for (auto _ : state) {
+        hasher->hash_batch(pixels.data(), count, hashes.data());
+        benchmark::DoNotOptimize(hashes.data());
+    }
+
+    state.SetLabel(hasher->name());
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+BENCHMARK(BM_RegisteredHasher)->DenseRange(0, hasher_names().size() - 1)->Unit(benchmark::kMicrosecond);
+
+static const char* const FORMATS[] = {"JPEG", "PNG"};
+
+// What imghash does for every file: read, decode and hash it. Files are in
+// the page cache after the first iteration, so it's decoding mostly.
+static void
+BM_CalcImageHash(benchmark::State& state)
+{
+    const size_t width = state.range(0);
+    const char* format = FORMATS[state.range(1)];
+    const bool shrink_on_load = state.range(2) != 0;
+
+    Magick::Image image = make_image(width, width * 3 / 4);
+    image.magick(format);
+
+    std::string path = "/tmp/imgdupl-bench-" + std::to_string(getpid()) + "-" + std::to_string(width) + "." + format;
+    image.write(path);
+
+    DCTHasher<50, PHASH_BITS> hasher;
+
+    for (auto _ : state) {
+        auto hash = calc_image_hash(path, hasher, shrink_on_load);
+        if (!hash.first) {
+            state.SkipWithError("couldn't hash the image");
+            break;
+        }
+        benchmark::DoNotOptimize(hash);
+    }
+
+    unlink(path.c_str());
+
+    state.SetLabel(format);
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void
+image_args(benchmark::internal::Benchmark* b)
+{
+    for (int64_t width : {320, 1024, 4000}) {
+        for (int64_t format = 0; format < 2; format++) {
+            for (int64_t shrink_on_load : {0, 1}) {
+                b->Args({width, format, shrink_on_load});
+            }
+        }
+    }
+}
+
+BENCHMARK(BM_CalcImageHash)->Apply(image_args)->ArgNames({"width", "format", "shrink"})->Unit(benchmark::kMillisecond);
@@ -0,0 +1,131 @@
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "hash_store.hpp"
+#include "linear_scan.hpp"
+#include "multi_index_hash.hpp"
+#include "metric_tree.hpp"
+
+using namespace imgdupl;
+
+// images per cluster and the most bits an image differs from its cluster's
+// center in
+static const size_t CLUSTER_SIZE = 8;
+static const int MAX_NOISE_BITS = 12;
+
+// Random cluster centers and their noisy copies, which looks more like real
+// data than uniformly random hashes.
+static void
+fill_clustered(HashStore& store, size_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+
+    store.reserve(count);
+
+    PHash center;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i % CLUSTER_SIZE == 0) {
+            for (auto& v : center) {
+                v = rng();
+            }
+        }
+
+        PHash hash = center;
+        for (int k = rng() % (MAX_NOISE_BITS + 1); k > 0; k--) {
+            int bit = rng() % PHASH_BITS;
+            hash[bit / 64] ^= uint64_t(1) << (bit % 64);
+        }
+
+        store.push_back(hash, i + 1);
+    }
+}
+
+// Stores and indexes are expensive to make, so they are made once per size and
+// shared by benchmarks. Queries don't change them.
+static HashStore&
+clustered_store(size_t count)
+{
+    static std::map<size_t, std::unique_ptr<HashStore>> stores;
+
+    auto& store = stores[count];
+    if (!store) {
+        store.reset(new HashStore);
+        fill_clustered(*store, count, 1);
+    }
+
+    return *store;
+}
+
+template <typename Index>
+static Index&
+cached_index(size_t count)
+{
+    static std::map<size_t, std::unique_ptr<Index>> indexes;
+
+    auto& index = indexes[count];
+    if (!index) {
+        index.reset(new Index(clustered_store(count)));
+    }
+
+    return *index;
+}
+
+// Queries with noisy copies of hashes from the store, so every query has
+// neighbours to find like a cluster base in the clusterizer has.
+template <typename Index>
+static void
+BM_IndexQuery(benchmark::State& state)
+{
+    const size_t count = state.range(0);
+    const int threshold = state.range(1);
+
+    HashStore& store = clustered_store(count);
+    Index& index = cached_index<Index>(count);
+
+    std::mt19937_64 rng(2);
+    std::vector<size_t> found;
+    size_t found_total = 0;
+
+    for (auto _ : state) {
+        PHash base = store.hash(rng() % count);
+        base[0] ^= uint64_t(1) << (rng() % 64);
+
+        found.clear();
+        index.query(base, 0, threshold, found);
+        benchmark::DoNotOptimize(found.data());
+
+        found_total += found.size();
+    }
+
+    state.counters["found"] = benchmark::Counter(found_total, benchmark::Counter::kAvgIterations);
+}
+
+// the trees are single threaded, so is the scan they are compared with
+struct SingleThreadedScanner : public LinearScanner {
+    SingleThreadedScanner(HashStore& store)
+        : LinearScanner(store, 1)
+    {
+    }
+};
+
+static void
+index_args(benchmark::internal::Benchmark* b)
+{
+    for (int64_t count : {1000000, 10000000}) {
+        for (int64_t threshold : {8, 16, 24, 32}) {
+            b->Args({count, threshold});
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_IndexQuery, SingleThreadedScanner)->Apply(index_args)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_IndexQuery, MultiIndexHash)->Apply(index_args)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_IndexQuery, BKTree)->Apply(index_args)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_IndexQuery, VPTree)->Apply(index_args)->Unit(benchmark::kMicrosecond);
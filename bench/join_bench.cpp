@@ -0,0 +1,88 @@
+#include <stdint.h>
+
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "hash_store.hpp"
+#include "hamming_join.hpp"
+
+using namespace imgdupl;
+
+static void
+fill_random(HashStore::Hashes& hashes, size_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+
+    hashes.resize(count);
+
+    for (auto& hash : hashes) {
+        for (auto& v : hash) {
+            v = rng();
+        }
+    }
+}
+
+// Two tiles which stay in L1 compared again and again, nothing but the
+// kernel itself is measured. This is the roof the whole join is compared
+// with below.
+static void
+BM_JoinTiles(benchmark::State& state)
+{
+    const size_t count = HammingJoin::TILE_SIZE;
+    const int threshold = 20;
+
+    HashStore::Hashes a, b;
+    fill_random(a, count, 1);
+    fill_random(b, count, 2);
+
+    size_t found = 0;
+    HammingJoin::Sink sink = [&](int, const HammingPair*, size_t n) { found += n; };
+
+    for (auto _ : state) {
+        HammingJoin::join_tiles(a.data(), count, 0, b.data(), count, count, false, threshold, 0, sink);
+    }
+
+    benchmark::DoNotOptimize(found);
+
+    state.counters["comparisons_per_core"]
+        = benchmark::Counter(double(count) * count * state.iterations(), benchmark::Counter::kIsRate);
+}
+
+// The whole join with the given number of threads, comparisons per second
+// are divided by the number of threads, so with perfect scaling they stay
+// close to BM_JoinTiles.
+static void
+BM_HammingJoin(benchmark::State& state)
+{
+    const size_t count = state.range(0);
+    const int threads = state.range(1);
+    const int threshold = 20;
+
+    HashStore::Hashes hashes;
+    fill_random(hashes, count, 1);
+
+    ScanScheduler scheduler(threads, 1);
+
+    for (auto _ : state) {
+        HammingJoin::run(hashes.data(), count, threshold, scheduler, [](int, const HammingPair* pairs, size_t) {
+            benchmark::DoNotOptimize(pairs);
+        });
+    }
+
+    state.counters["comparisons_per_core"] = benchmark::Counter(
+        double(HammingJoin::comparisons(count)) * state.iterations() / threads, benchmark::Counter::kIsRate);
+}
+
+static void
+join_args(benchmark::internal::Benchmark* b)
+{
+    for (int64_t count : {100000, 1000000}) {
+        for (int64_t threads : {1, 2, 4, 8, 16, 32, 64}) {
+            b->Args({count, threads});
+        }
+    }
+}
+
+BENCHMARK(BM_JoinTiles)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_HammingJoin)->Apply(join_args)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,118 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "hash_store.hpp"
+#include "linear_scan.hpp"
+#include "hamming_kernel.hpp"
+
+using namespace imgdupl;
+
+static void
+fill_random(HashStore& store, size_t count, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+
+    store.reserve(count);
+
+    for (size_t i = 0; i < count; i++) {
+        PHash hash;
+        for (auto& v : hash) {
+            v = rng();
+        }
+        store.push_back(hash, i + 1);
+    }
+}
+
+// One clusterizer step: a scan of the whole store for images close to a base
+// hash, with the given number of threads.
+static void
+BM_LinearScan(benchmark::State& state)
+{
+    const size_t count = 1000000;
+    const int threshold = 20;
+
+    HashStore store;
+    fill_random(store, count, 1);
+
+    LinearScanner scanner(store, state.range(0));
+
+    std::mt19937_64 rng(2);
+    std::vector<size_t> found;
+
+    for (auto _ : state) {
+        PHash base;
+        for (auto& v : base) {
+            v = rng();
+        }
+
+        found.clear();
+        scanner.scan(base, 0, count, threshold, found);
+        benchmark::DoNotOptimize(found.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+BENCHMARK(BM_LinearScan)->RangeMultiplier(2)->Range(1, 64)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+static bool
+kernel_supported(const std::string& name)
+{
+    __builtin_cpu_init();
+
+    if (name == "avx512") {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+    } else if (name == "avx2") {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    return true;
+}
+
+// Distances from a base to 1M hashes with one kernel on one thread, the part
+// of a scan which doesn't depend on the scheduler. The scalar kernel rejects
+// pairs by the first word alone with small thresholds, hence several of them.
+static void
+BM_MatchBlock(benchmark::State& state, MatchBlockFunc match_block, const std::string& name)
+{
+    if (!kernel_supported(name)) {
+        state.SkipWithError("not supported by the CPU");
+        return;
+    }
+
+    const size_t count = 1000000;
+    const int threshold = state.range(0);
+
+    HashStore store;
+    fill_random(store, count, 1);
+
+    std::mt19937_64 rng(2);
+    uint64_t matched = 0;
+
+    for (auto _ : state) {
+        PHash base;
+        for (auto& v : base) {
+            v = rng();
+        }
+
+        for (size_t i = 0; i < count; i += HashStore::BLOCK_SIZE) {
+            matched |= match_block(base, store.hashes() + i, std::min(HashStore::BLOCK_SIZE, count - i), threshold);
+        }
+    }
+
+    benchmark::DoNotOptimize(matched);
+
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+BENCHMARK_CAPTURE(BM_MatchBlock, scalar, match_block_scalar, "scalar")->Arg(8)->Arg(20)->Arg(32)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_MatchBlock, avx2, match_block_avx2, "avx2")->Arg(8)->Arg(20)->Arg(32)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_MatchBlock, avx512, match_block_avx512, "avx512")->Arg(8)->Arg(20)->Arg(32)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
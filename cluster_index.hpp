@@ -0,0 +1,34 @@
+#ifndef __CLUSTER_INDEX_HPP_INCLUDED__
+#define __CLUSTER_INDEX_HPP_INCLUDED__
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "phash.hpp"
+
+namespace imgdupl
+{
+
+// Finds images close to a cluster base for the greedy clusterization. Images
+// live in a HashStore, an index refers to them by positions in the store.
+class ClusterIndex
+{
+public:
+    virtual ~ClusterIndex()
+    {
+    }
+
+    // Finds not processed images at positions from, from + 1, ... which are
+    // within threshold of the base hash, marks them as processed in the store
+    // and appends their positions to found in ascending order.
+    virtual void extract(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) = 0;
+
+    // Same as extract(), but processed images are found too and nothing is
+    // changed.
+    virtual void query(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) = 0;
+};
+
+} // namespace imgdupl
+
+#endif
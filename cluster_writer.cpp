@@ -0,0 +1,47 @@
+#include <errno.h>
+#include <string.h>
+
+#include "cluster_writer.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+ClusterWriter::ClusterWriter(FILE* out_)
+    : out(out_)
+    , buffer(BUFFER_SIZE)
+    , used(0)
+{
+}
+
+ClusterWriter::~ClusterWriter()
+{
+    if (used > 0) {
+        fwrite(buffer.data(), 1, used, out);
+    }
+
+    fflush(out);
+}
+
+void
+ClusterWriter::flush_buffer()
+{
+    if (used == 0) {
+        return;
+    }
+
+    size_t written = fwrite(buffer.data(), 1, used, out);
+    THROW_EXC_IF_FAILED(written == used, "fwrite() failed: %s", strerror(errno));
+
+    used = 0;
+}
+
+void
+ClusterWriter::flush()
+{
+    flush_buffer();
+
+    THROW_EXC_IF_FAILED(fflush(out) == 0, "fflush() failed: %s", strerror(errno));
+}
+
+} // namespace imgdupl
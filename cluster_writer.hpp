@@ -0,0 +1,77 @@
+#ifndef __CLUSTER_WRITER_HPP_INCLUDED__
+#define __CLUSTER_WRITER_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+namespace imgdupl
+{
+
+// Writes "<image id>\t<cluster id>" lines of clusterization results. Lines are
+// formatted into a large buffer which goes to the file with a single write
+// when it's full, so printing a cluster costs no system calls most of the
+// time and the main thread gets back to the scan quickly.
+class ClusterWriter
+{
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    ClusterWriter(FILE* out);
+
+    // Flushes what's left, errors are ignored here, call flush() to see them.
+    ~ClusterWriter();
+
+    void write(uint32_t image_id, uint64_t cluster_id)
+    {
+        // two numbers, a tab and a newline always fit
+        if (BUFFER_SIZE - used < 32) {
+            flush_buffer();
+        }
+
+        char* p = buffer.data() + used;
+
+        p = format(p, image_id);
+        *p++ = '\t';
+        p = format(p, cluster_id);
+        *p++ = '\n';
+
+        used = p - buffer.data();
+    }
+
+    // Writes buffered lines out and flushes the file, throws on errors.
+    void flush();
+
+    ClusterWriter(ClusterWriter const&) = delete;
+    ClusterWriter& operator=(ClusterWriter const&) = delete;
+
+private:
+    FILE* out;
+    std::vector<char> buffer;
+    size_t used;
+
+    void flush_buffer();
+
+    static char* format(char* p, uint64_t v)
+    {
+        char digits[20];
+        int n = 0;
+
+        do {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v != 0);
+
+        while (n > 0) {
+            *p++ = digits[--n];
+        }
+
+        return p;
+    }
+};
+
+} // namespace imgdupl
+
+#endif
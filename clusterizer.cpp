@@ -1,165 +1,35 @@
 #include <stdlib.h>
 #include <stdint.h>
-#include <assert.h>
 
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <iostream>
 #include <fstream>
-#include <queue>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <memory>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 
-#include <sqlite3.h>
-#include <thread_pool.hpp>
+#include <cxxopts.hpp>
 
 #include "hash_delimeter.hpp"
-#include "tokenizer.hpp"
 #include "phash.hpp"
 #include "exc.hpp"
+#include "hash_store.hpp"
+#include "hashes_db.hpp"
+#include "hash_index.hpp"
+#include "clusters_db.hpp"
+#include "linear_scan.hpp"
+#include "multi_index_hash.hpp"
+#include "metric_tree.hpp"
+#include "cluster_writer.hpp"
+#include "shard_plan.hpp"
+#include "union_find.hpp"
+#include "components.hpp"
 
 using namespace imgdupl;
 
-std::condition_variable compactifier_cv;
-std::mutex compactifier_mtx;
-
-template <typename Data>
-class ConcurrentQueue
-{
-public:
-    typedef Data value_type;
-
-    ConcurrentQueue()
-    {
-    }
-
-    void push(const Data& data)
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-
-        queue.push(data);
-        lock.unlock();
-        condvar.notify_one();
-    }
-
-    bool empty() const
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-        return queue.empty();
-    }
-
-    bool try_pop(Data& popped_value)
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-
-        if (queue.empty()) {
-            return false;
-        }
-
-        popped_value = queue.front();
-        queue.pop();
-
-        return true;
-    }
-
-    void wait_and_pop(Data& popped_value)
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-
-        while (queue.empty()) {
-            condvar.wait(lock);
-        }
-
-        popped_value = queue.front();
-        queue.pop();
-    }
-
-    size_t size() const
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-
-        return queue.size();
-    }
-
-    ConcurrentQueue(ConcurrentQueue const&) = delete;
-    ConcurrentQueue& operator=(ConcurrentQueue const&) = delete;
-
-private:
-    std::queue<Data> queue;
-    mutable std::mutex mutex;
-    std::condition_variable condvar;
-};
-
-class Image
-{
-public:
-    PHash hash;
-    uint32_t image_id;
-    uint32_t processed;
-
-    Image()
-        : image_id(0)
-        , processed(0)
-    {
-    }
-
-    Image(const PHash& hash_, uint32_t image_id_, uint32_t processed_ = 0)
-        : hash(hash_)
-        , image_id(image_id_)
-        , processed(processed_)
-    {
-    }
-};
-
-typedef std::vector<Image> Images;
-
-class ClusterEntry
-{
-public:
-    PHash hash;
-    uint32_t image_id;
-
-    ClusterEntry()
-        : image_id(0)
-    {
-    }
-
-    ClusterEntry(const PHash& hash_, uint32_t image_id_)
-        : hash(hash_)
-        , image_id(image_id_)
-    {
-    }
-};
-
-typedef std::vector<ClusterEntry> ClusterEntries;
-
-class Task
-{
-public:
-    PHash cluster_base_hash;
-    Images::iterator cur_it;
-    Images::iterator end_it;
-    ClusterEntries cluster_entries;
-
-    Task()
-    {
-        cluster_base_hash.reserve(16);
-    }
-
-    Task(const PHash& cluster_base_hash_, Images::iterator cur_it_, Images::iterator end_it_)
-        : cluster_base_hash(cluster_base_hash_)
-        , cur_it(cur_it_)
-        , end_it(end_it_)
-    {
-    }
-};
-
-typedef std::shared_ptr<Task> TaskPtr;
-typedef ConcurrentQueue<TaskPtr> TasksQueue;
-
 std::ostream&
 operator<<(std::ostream& out, const PHash& mhash)
 {
@@ -179,266 +49,385 @@ operator<<(std::ostream& out, const PHash& mhash)
 }
 
 void
-usage(const char* program)
+output_cluster(ClusterWriter& writer, uint64_t& cluster_id, const HashStore& images, const std::vector<size_t>& entries)
 {
-    std::cout << "Usage: " << program << " <data> <threshold> <threads>" << std::endl << std::endl;
-    std::cout << "Where: " << std::endl;
-    std::cout << " data      -- SQLite database with perceptual hashes" << std::endl;
-    std::cout << " threshold -- distance between two hashes" << std::endl;
-    std::cout << " threads   -- number of threads to run" << std::endl << std::endl;
-
-    std::cout << "Example: " << program << " hashes.db 22 8" << std::endl << std::endl;
+    cluster_id++;
 
-    exit(0);
+    for (auto& v : entries) {
+        writer.write(images.image_id(v), cluster_id);
+    }
 }
 
-PHash
-make_hash(const std::string& data)
+std::unique_ptr<ClusterIndex>
+make_index(const std::string& name, HashStore& images, int threads_num, int mih_substrings, int hash_bits)
 {
-    PHash hash;
-
-    Separator separator(HASH_PRINT_DELIMETER);
-    Tokenizer tokenizer(data, separator);
-
-    for (auto& v : tokenizer) {
-        hash.push_back(std::stoull(v));
+    if (name == "linear") {
+        return std::unique_ptr<ClusterIndex>(new LinearScanner(images, threads_num));
+    } else if (name == "mih") {
+        return std::unique_ptr<ClusterIndex>(new MultiIndexHash(images, mih_substrings, hash_bits));
+    } else if (name == "bktree") {
+        return std::unique_ptr<ClusterIndex>(new BKTree(images));
+    } else if (name == "vptree") {
+        return std::unique_ptr<ClusterIndex>(new VPTree(images));
     }
 
-    return hash;
+    THROW_EXC("unknown index '%s', must be one of 'linear', 'mih', 'bktree' or 'vptree'", name.c_str());
 }
 
+// Greedy clusterization, ids of clusters start from cluster_id + 1.
 void
-read_data_from_db(std::string name, Images& images)
+clusterize(HashStore& images, ClusterIndex& index, ClusterWriter& writer, int threshold, uint64_t cluster_id = 0)
 {
-    sqlite3* db = NULL;
+    PHash cluster_base_hash;
 
-    int rc = sqlite3_initialize();
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_initialize() failed");
+    // positions of cluster members in the store, the base image goes first
+    std::vector<size_t> entries;
 
-    rc = sqlite3_open_v2(name.c_str(), &db, SQLITE_OPEN_READONLY, NULL);
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+    size_t cur = 0;
+    size_t end = images.size();
 
-    std::string st = "SELECT id, hash FROM hashes";
-    sqlite3_stmt* stmt = NULL;
+    while ((cur = images.next_unprocessed(cur)) != end) {
+        if (images.hash(cur)[0] == 0) {
+            cur++;
+        } else {
+            cluster_base_hash = images.hash(cur);
 
-    rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+            entries.clear();
+            entries.push_back(cur);
 
-    for (;;) {
-        rc = sqlite3_step(stmt);
-        THROW_EXC_IF_FAILED(rc == SQLITE_ROW || rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
-        if (rc == SQLITE_DONE) {
-            break;
-        }
+            images.mark_processed(cur);
+            cur++;
 
-        uint32_t image_id = sqlite3_column_int(stmt, 0);
-        std::string hash_data
-            = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)), sqlite3_column_bytes(stmt, 1));
-        PHash hash = make_hash(hash_data);
+            index.extract(cluster_base_hash, cur, threshold, entries);
 
-        images.push_back(Image(hash, image_id));
+            output_cluster(writer, cluster_id, images, entries);
+        }
     }
-
-    rc = sqlite3_finalize(stmt);
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
-
-    sqlite3_close(db);
-    sqlite3_shutdown();
 }
 
-int
-hamming_distance(uint64_t hash1, uint64_t hash2)
+// Clusters are connected components of the graph where images within
+// threshold of each other are linked, so unlike the greedy clusterization the
+// result doesn't depend on the order of images. Clusters are numbered in order
+// of their first images, images of a cluster keep their order.
+void
+clusterize_components(const HashStore& images, int threads_num, ClusterWriter& writer, int threshold)
 {
-    uint64_t x = hash1 ^ hash2;
+    size_t size = images.size();
+    ConcurrentUnionFind components(size);
 
-    return __builtin_popcountll(x);
-}
+    // every chunk is a pair of tiles of the join
+    ScanScheduler scheduler(threads_num, 1);
+    unite_similar(images, threshold, scheduler, components);
 
-bool
-distance(const PHash& mh1, const PHash& mh2, int threshold)
-{
-    size_t hash_size = mh1.size();
-    int dist = 0;
+    // counting sort of images by their components, a component is
+    // represented by its first image
+    std::vector<uint32_t> offsets(size + 1, 0);
+    std::vector<uint32_t> roots(size);
 
-    for (size_t i = 0; i < hash_size; i++) {
-        dist += hamming_distance(mh1[i], mh2[i]);
+    for (size_t i = 0; i < size; i++) {
+        roots[i] = components.find(i);
+        offsets[roots[i] + 1]++;
     }
 
-    return (dist <= threshold);
-}
+    for (size_t i = 0; i < size; i++) {
+        offsets[i + 1] += offsets[i];
+    }
 
-void
-make_cluster(const PHash& cluster_base_hash,
-    Images::iterator cur_it,
-    Images::iterator end_it,
-    int threshold,
-    ClusterEntries& entries)
-{
-    assert(cur_it != end_it);
+    std::vector<uint32_t> members(size);
 
-    for (; cur_it != end_it; ++cur_it) {
-        if (!cur_it->processed && distance(cluster_base_hash, cur_it->hash, threshold)) {
-            entries.push_back(ClusterEntry(cur_it->hash, cur_it->image_id));
-            cur_it->processed = 1;
+    for (size_t i = 0; i < size; i++) {
+        members[offsets[roots[i]]++] = i;
+    }
+
+    uint64_t cluster_id = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        // images with zero hashes failed to load
+        if (images.hash(members[i])[0] == 0) {
+            continue;
+        }
+
+        if (members[i] == roots[members[i]]) {
+            cluster_id++;
         }
+
+        writer.write(images.image_id(members[i]), cluster_id);
     }
 }
 
+// Adds images which aren't in any cluster of the table yet to the existing
+// clusters: an image joins the first cluster whose base image is within
+// threshold, images which join none are clusterized among themselves into new
+// clusters. Only new members of existing clusters and new clusters are
+// printed, grouped by cluster, for export2db clusters-append. Clusters whose
+// base image has been removed from the hashes table get no new members.
 void
-worker(int threshold, TaskPtr task, TasksQueue& accomplished_tasks_queue)
+clusterize_incremental(HashStore& images,
+    const std::string& db_name,
+    const std::string& table,
+    const std::string& index_name,
+    int threads_num,
+    int mih_substrings,
+    int hash_bits,
+    ClusterWriter& writer,
+    int threshold)
 {
-    make_cluster(task->cluster_base_hash, task->cur_it, task->end_it, threshold, task->cluster_entries);
-    accomplished_tasks_queue.push(task);
-}
+    std::vector<StoredCluster> clusters;
+    read_clusters_from_db(db_name, table, clusters);
 
-void
-output_cluster(uint64_t& cluster_id, ClusterEntries const& entries)
-{
-    cluster_id++;
+    std::unordered_set<uint32_t> clustered;
+    uint64_t max_cluster_id = 0;
 
-    for (auto& v : entries) {
-        std::cout << v.image_id << '\t' << cluster_id << std::endl << std::flush;
+    for (auto& c : clusters) {
+        clustered.insert(c.images.begin(), c.images.end());
+        max_cluster_id = std::max<uint64_t>(max_cluster_id, c.id);
     }
-}
 
-Images
-compactify(Images::iterator cur_it, Images::iterator end_it)
-{
-    Images images;
-    images.reserve(std::distance(cur_it, end_it));
+    std::unordered_map<uint32_t, size_t> positions;
+    for (size_t i = 0; i < images.size(); i++) {
+        positions[images.image_id(i)] = i;
+    }
 
-    std::copy_if(
-        cur_it, end_it, std::back_inserter(images), [](Images::value_type const& v) { return v.processed == 0; });
+    HashStore bases;
+    std::vector<uint32_t> base_cluster_ids;
 
-    return images;
-}
+    for (auto& c : clusters) {
+        auto it = c.images.empty() ? positions.end() : positions.find(c.images[0]);
+        if (it != positions.end()) {
+            bases.push_back(images.hash(it->second), c.images[0]);
+            base_cluster_ids.push_back(c.id);
+        }
+    }
 
-void
-compactification_reminder(int seconds, std::atomic_bool& deflate_data)
-{
-    for (;;) {
-        std::unique_lock<std::mutex> lock(compactifier_mtx);
-        auto r = compactifier_cv.wait_for(lock, std::chrono::seconds(seconds));
-        if (r == std::cv_status::no_timeout) {
-            break;
+    HashStore fresh;
+
+    for (size_t i = 0; i < images.size(); i++) {
+        if (clustered.count(images.image_id(i)) == 0) {
+            fresh.push_back(images.hash(i), images.image_id(i));
         }
+    }
+
+    std::cerr << fresh.size() << " new images, " << bases.size() << " clusters to extend" << std::endl;
 
-        deflate_data = true;
+    // new members of existing clusters by cluster id
+    std::map<uint32_t, std::vector<uint32_t>> joined;
+
+    if (bases.size() > 0) {
+        auto base_index = make_index(index_name, bases, threads_num, mih_substrings, hash_bits);
+        std::vector<size_t> found;
+
+        for (size_t i = 0; i < fresh.size(); i++) {
+            found.clear();
+            base_index->query(fresh.hash(i), 0, threshold, found);
+
+            // bases are in order of clusters, the first one would have got
+            // the image in a full clusterization too
+            if (!found.empty()) {
+                joined[base_cluster_ids[found[0]]].push_back(fresh.image_id(i));
+                fresh.mark_processed(i);
+            }
+        }
+    }
+
+    for (auto& v : joined) {
+        for (auto& image_id : v.second) {
+            writer.write(image_id, v.first);
+        }
     }
+
+    auto fresh_index = make_index(index_name, fresh, threads_num, mih_substrings, hash_bits);
+
+    clusterize(fresh, *fresh_index, writer, threshold, max_cluster_id);
 }
 
-int
-main(int argc, char** argv)
+// Finds connected components of images within threshold of each other among
+// images compared by one shard of the plan. Every image of blocks the shard
+// deals with is printed with a shard local cluster id, merge-clusters unites
+// results of all shards into clusters over the whole data set.
+void
+clusterize_shard(const HashStore& images,
+    const ShardPlan& plan,
+    const std::string& index_name,
+    int threads_num,
+    int mih_substrings,
+    int hash_bits,
+    ClusterWriter& writer,
+    int threshold)
 {
-    if (argc < 4) {
-        usage(argv[0]);
+    std::vector<bool> used_blocks(plan.blocks(), false);
+
+    for (auto& t : plan.tasks()) {
+        used_blocks[t.first] = true;
+        used_blocks[t.second] = true;
     }
 
-    std::string datafile = argv[1];
+    // images with zero hashes failed to load, the greedy clusterization
+    // skips them too
+    std::vector<HashStore> blocks(plan.blocks());
 
-    auto threshold = std::stoi(argv[2]);
-    auto threads_num = std::stoi(argv[3]);
+    for (size_t i = 0; i < images.size(); i++) {
+        size_t block = plan.block_of(images.image_id(i));
 
-    if (threshold <= 0 || threads_num <= 0) {
-        std::cerr << "invalid args: can't be less than 1" << std::endl;
-        return EXIT_FAILURE;
+        if (used_blocks[block] && images.hash(i)[0] != 0) {
+            blocks[block].push_back(images.hash(i), images.image_id(i));
+        }
     }
 
-    thread_pool pool(threads_num);
+    // images of all used blocks are numbered one block after another
+    std::vector<size_t> first_of_block(plan.blocks() + 1, 0);
 
-    Images images;
+    for (size_t b = 0; b < plan.blocks(); b++) {
+        first_of_block[b + 1] = first_of_block[b] + blocks[b].size();
+    }
 
-    read_data_from_db(datafile, images);
+    UnionFind components(first_of_block.back());
+    std::vector<size_t> found;
 
-    TasksQueue accomplished_tasks_queue;
-    std::atomic_bool deflate_data = false;
+    for (auto& t : plan.tasks()) {
+        HashStore& queries = blocks[t.first];
+        HashStore& targets = blocks[t.second];
 
-    std::thread reminder(compactification_reminder, 60, std::ref(deflate_data));
-    reminder.detach();
+        if (queries.size() == 0 || targets.size() == 0) {
+            continue;
+        }
 
-    Images::iterator cur_task_it, end_task_it;
+        auto index = make_index(index_name, targets, threads_num, mih_substrings, hash_bits);
 
-    uint64_t cluster_id = 0;
-    PHash cluster_base_hash;
+        for (size_t i = 0; i < queries.size(); i++) {
+            found.clear();
+            index->query(queries.hash(i), t.first == t.second ? i + 1 : 0, threshold, found);
 
-    size_t distance;
-    size_t job_length;
+            for (auto& v : found) {
+                components.unite(first_of_block[t.first] + i, first_of_block[t.second] + v);
+            }
+        }
+    }
 
-    ClusterEntries entries;
+    std::cerr << "shard " << plan.shard() << " of " << plan.shards() << ": " << plan.tasks().size() << " tasks, "
+              << components.size() << " images" << std::endl;
 
-    auto cur_it = images.begin();
-    auto end_it = images.end();
+    // (component, image id) of every image, grouped by components
+    std::vector<std::pair<uint32_t, uint32_t>> members;
+    members.reserve(components.size());
 
-    while (cur_it != end_it) {
-        if (cur_it->processed || cur_it->hash[0] == 0) {
-            cur_it++;
-        } else {
-            cluster_base_hash = cur_it->hash;
+    for (size_t b = 0; b < plan.blocks(); b++) {
+        for (size_t i = 0; i < blocks[b].size(); i++) {
+            members.push_back(std::make_pair(components.find(first_of_block[b] + i), blocks[b].image_id(i)));
+        }
+    }
 
-            entries.clear();
-            entries.push_back(ClusterEntry(cluster_base_hash, cur_it->image_id));
+    std::sort(members.begin(), members.end());
+
+    for (auto& v : members) {
+        writer.write(v.second, v.first + 1);
+    }
+}
 
-            cur_it->processed = 1;
-            cur_it++;
+int
+main(int argc, char** argv)
+{
+    try {
+        cxxopts::Options args(argv[0], "find clusters of perceptually similar images");
+
+        // clang-format off
+        args.add_options()
+            ("h,help", "show this help and exit")
+            ("data", "SQLite database or index file with perceptual hashes", cxxopts::value<std::string>())
+            ("threshold", "distance between two hashes", cxxopts::value<int>())
+            ("threads", "number of threads to run", cxxopts::value<int>())
+            ("i,index", "index to search for similar images: 'linear' (scan), 'mih' (multi-index hashing), "
+                "'bktree' (BK-tree) or 'vptree' (vantage point tree)",
+                cxxopts::value<std::string>()->default_value("linear"))
+            ("mih-substrings", "number of substrings in multi-index hashing, chosen by number of images if 0",
+                cxxopts::value<int>()->default_value("0"))
+            ("incremental", "add images which aren't clustered yet to clusters from this table of the database",
+                cxxopts::value<std::string>())
+            ("m,mode", "'greedy' makes a cluster of everything close to its first image, 'components' makes clusters "
+                "of images linked by chains of close ones", cxxopts::value<std::string>()->default_value("greedy"))
+            ("algo", "fail unless hashes were calculated with this algorithm of imghash --algo",
+                cxxopts::value<std::string>())
+            ("shard", "compare only the part K/N (K is 0 ... N - 1) of pairs of images and print connected components "
+                "of it, merge results of all N parts with merge-clusters", cxxopts::value<std::string>())
+            ;
+        // clang-format on
+
+        args.parse_positional({"data", "threshold", "threads"});
+        args.positional_help("<data> <threshold> <threads>");
+
+        auto opts = args.parse(argc, argv);
+
+        if (opts.count("help") || opts.count("data") == 0 || opts.count("threshold") == 0 || opts.count("threads") == 0) {
+            std::cout << args.help() << std::endl;
+            std::cout << "Example: " << argv[0] << " hashes.db 22 8" << std::endl << std::endl;
+            return EXIT_SUCCESS;
+        }
 
-            if (cur_it == end_it) {
-                output_cluster(cluster_id, entries);
-                break;
-            }
+        auto threshold = opts["threshold"].as<int>();
+        auto threads_num = opts["threads"].as<int>();
 
-            distance = std::distance(cur_it, end_it);
+        if (threshold <= 0 || threads_num <= 0) {
+            std::cerr << "invalid args: can't be less than 1" << std::endl;
+            return EXIT_FAILURE;
+        }
 
-            job_length = distance / threads_num;
-            cur_task_it = end_task_it = cur_it;
+        auto data = opts["data"].as<std::string>();
 
-            std::advance(end_task_it, job_length);
+        // hashes of the store may live in the mapped index file
+        std::unique_ptr<HashIndexFile> index_file;
+        HashStore images;
 
-            for (int i = 0; i < threads_num; i++) {
-                auto task = std::make_shared<Task>(cluster_base_hash, cur_task_it, end_task_it);
-                pool.push_task(worker, threshold, task, std::ref(accomplished_tasks_queue));
+        HashAlgorithm algo;
 
-                cur_task_it = end_task_it;
-                if (i == threads_num - 1) { // last task maybe a little lengthy
-                    end_task_it = end_it;
-                } else {
-                    std::advance(end_task_it, job_length);
-                }
-            }
+        if (HashIndexFile::is_hash_index(data)) {
+            index_file.reset(new HashIndexFile(data));
+            index_file->attach(images);
+            algo = index_file->algorithm();
+        } else {
+            read_hashes_from_db(data, images);
+            algo = read_hash_algorithm(data);
+        }
 
-            pool.wait_for_tasks();
+        if (opts.count("algo") > 0) {
+            check_hash_algorithm(data, algo, opts["algo"].as<std::string>());
+        }
 
-            // gather results
-            TaskPtr task;
+        std::cerr << images.size() << " " << algo.name << " hashes (" << algo.bits << " bits)" << std::endl;
 
-            for (int i = 0; i < threads_num; i++) {
-                accomplished_tasks_queue.wait_and_pop(task);
+        auto index_name = opts["index"].as<std::string>();
+        auto mih_substrings = opts["mih-substrings"].as<int>();
 
-                auto cur_cluster_it = task->cluster_entries.begin();
-                auto end_cluster_it = task->cluster_entries.end();
+        auto mode = opts["mode"].as<std::string>();
+        THROW_EXC_IF_FAILED(mode == "greedy" || mode == "components", "unknown mode '%s', must be 'greedy' or 'components'",
+            mode.c_str());
 
-                for (; cur_cluster_it != end_cluster_it; ++cur_cluster_it) {
-                    entries.push_back(*cur_cluster_it);
-                }
-            }
+        ClusterWriter writer(stdout);
 
-            output_cluster(cluster_id, entries);
+        if (mode == "components") {
+            THROW_EXC_IF_FAILED(opts.count("incremental") == 0 && opts.count("shard") == 0,
+                "components mode can't be combined with --incremental or --shard");
 
-            if (deflate_data) {
-                deflate_data = false;
+            clusterize_components(images, threads_num, writer, threshold);
+        } else if (opts.count("shard") > 0) {
+            THROW_EXC_IF_FAILED(opts.count("incremental") == 0, "sharded clusterization can't be incremental");
 
-                Images compactified_images;
-                compactified_images = compactify(cur_it, end_it);
+            clusterize_shard(images, ShardPlan::parse(opts["shard"].as<std::string>()), index_name, threads_num,
+                mih_substrings, algo.bits, writer, threshold);
+        } else if (opts.count("incremental") > 0) {
+            THROW_EXC_IF_FAILED(!index_file, "incremental clusterization needs a database, not an index file");
 
-                images = compactified_images;
+            clusterize_incremental(images, data, opts["incremental"].as<std::string>(), index_name, threads_num,
+                mih_substrings, algo.bits, writer, threshold);
+        } else {
+            auto index = make_index(index_name, images, threads_num, mih_substrings, algo.bits);
 
-                cur_it = images.begin();
-                end_it = images.end();
-            }
+            clusterize(images, *index, writer, threshold);
         }
-    }
 
-    compactifier_cv.notify_one();
-    pool.wait_for_tasks();
+        writer.flush();
+    } catch (std::exception& exc) {
+        std::cerr << "Error: " << exc.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,165 @@
+#include <cstring>
+#include <cstdio>
+
+#include <sqlite3.h>
+
+#include "clusters_db.hpp"
+#include "hashes_db.hpp"
+#include "tokenizer.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+void
+read_clusters_from_db(const std::string& name, const std::string& table, std::vector<StoredCluster>& clusters)
+{
+    sqlite3* db = NULL;
+
+    int rc = sqlite3_initialize();
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_initialize() failed");
+
+    rc = sqlite3_open_v2(name.c_str(), &db, SQLITE_OPEN_READONLY, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+
+    char st[512];
+    sqlite3_stmt* stmt = NULL;
+
+    snprintf(st, sizeof(st), "SELECT cluster_id, images FROM %s ORDER BY cluster_id", table.c_str());
+
+    rc = sqlite3_prepare_v2(db, st, strlen(st), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    Tokens tokens;
+
+    for (;;) {
+        rc = sqlite3_step(stmt);
+        THROW_EXC_IF_FAILED(rc == SQLITE_ROW || rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+        if (rc == SQLITE_DONE) {
+            break;
+        }
+
+        StoredCluster cluster;
+
+        cluster.id = sqlite3_column_int(stmt, 0);
+
+        std::string images
+            = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)), sqlite3_column_bytes(stmt, 1));
+        tokenize(images, tokens, ",");
+
+        for (auto& v : tokens) {
+            cluster.images.push_back(std::stoul(v));
+        }
+
+        clusters.push_back(std::move(cluster));
+    }
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    sqlite3_close(db);
+    sqlite3_shutdown();
+}
+
+std::string
+members_table_name(const std::string& clusters_table)
+{
+    return clusters_table + "_members";
+}
+
+void
+create_members_table(sqlite3* db, const std::string& clusters_table)
+{
+    std::string members_table = members_table_name(clusters_table);
+
+    if (table_exists(db, members_table)) {
+        return;
+    }
+
+    std::string st = "CREATE TABLE " + members_table + " (cluster_id INTEGER, image_id INTEGER)";
+    char* errmsg;
+
+    int rc = sqlite3_exec(db, st.c_str(), NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+
+    // clusters exported by older versions
+    st = "SELECT cluster_id, images FROM " + clusters_table + " ORDER BY rowid";
+    sqlite3_stmt* stmt = NULL;
+
+    rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    try {
+        ClusterMembersInserter inserter(db, clusters_table);
+        Tokens tokens;
+
+        for (;;) {
+            rc = sqlite3_step(stmt);
+            THROW_EXC_IF_FAILED(rc == SQLITE_ROW || rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+            if (rc == SQLITE_DONE) {
+                break;
+            }
+
+            uint32_t cluster_id = sqlite3_column_int(stmt, 0);
+
+            std::string images
+                = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)), sqlite3_column_bytes(stmt, 1));
+            tokenize(images, tokens, ",");
+
+            for (auto& v : tokens) {
+                inserter.insert(cluster_id, std::stoul(v));
+            }
+        }
+    } catch (...) {
+        sqlite3_finalize(stmt);
+        throw;
+    }
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+void
+index_members_table(sqlite3* db, const std::string& clusters_table)
+{
+    std::string members_table = members_table_name(clusters_table);
+    std::string st
+        = "CREATE INDEX IF NOT EXISTS " + members_table + "_cluster_id ON " + members_table + " (cluster_id)";
+    char* errmsg;
+
+    int rc = sqlite3_exec(db, st.c_str(), NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+}
+
+ClusterMembersInserter::ClusterMembersInserter(sqlite3* db_, const std::string& clusters_table)
+    : db(db_)
+    , stmt(NULL)
+{
+    std::string st = "INSERT INTO " + members_table_name(clusters_table) + " (cluster_id, image_id) VALUES(?, ?)";
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+ClusterMembersInserter::~ClusterMembersInserter()
+{
+    sqlite3_finalize(stmt);
+}
+
+void
+ClusterMembersInserter::insert(uint32_t cluster_id, uint32_t image_id)
+{
+    int rc = sqlite3_bind_int64(stmt, 1, cluster_id);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_int64() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_int64(stmt, 2, image_id);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_int64() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_reset(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_reset() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+} // namespace imgdupl
@@ -0,0 +1,54 @@
+#ifndef __CLUSTERS_DB_HPP_INCLUDED__
+#define __CLUSTERS_DB_HPP_INCLUDED__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+namespace imgdupl
+{
+
+// Cluster from a clusters table made by export2db, the first image is the
+// base one the others were matched against.
+struct StoredCluster {
+    uint32_t id;
+    std::vector<uint32_t> images;
+};
+
+void read_clusters_from_db(const std::string& name, const std::string& table, std::vector<StoredCluster>& clusters);
+
+// Every clusters table has a members table with one (cluster_id, image_id)
+// row per image, in the order images were added to the cluster, so that
+// clusters can be joined with the hashes table instead of looking up images
+// one by one.
+std::string members_table_name(const std::string& clusters_table);
+
+// Creates the members table unless it exists, a members table created for an
+// existing clusters table is filled from its images column.
+void create_members_table(sqlite3* db, const std::string& clusters_table);
+
+// Indexes the members table by cluster ids, cheaper after it's filled.
+void index_members_table(sqlite3* db, const std::string& clusters_table);
+
+class ClusterMembersInserter
+{
+public:
+    ClusterMembersInserter(sqlite3* db, const std::string& clusters_table);
+    ~ClusterMembersInserter();
+
+    void insert(uint32_t cluster_id, uint32_t image_id);
+
+    ClusterMembersInserter(ClusterMembersInserter const&) = delete;
+    ClusterMembersInserter& operator=(ClusterMembersInserter const&) = delete;
+
+private:
+    sqlite3* db;
+    sqlite3_stmt* stmt;
+};
+
+} // namespace imgdupl
+
+#endif
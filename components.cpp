@@ -0,0 +1,26 @@
+#include <assert.h>
+
+#include "components.hpp"
+#include "hamming_join.hpp"
+
+namespace imgdupl
+{
+
+void
+unite_similar(const HashStore& store, int threshold, ScanScheduler& scheduler, ConcurrentUnionFind& components)
+{
+    assert(components.size() == store.size());
+
+    HammingJoin::run(store.hashes(), store.size(), threshold, scheduler,
+        [&](int, const HammingPair* pairs, size_t count) {
+            for (size_t k = 0; k < count; k++) {
+                const HammingPair& p = pairs[k];
+
+                if (store.hash(p.i)[0] != 0 && store.hash(p.j)[0] != 0) {
+                    components.unite(p.i, p.j);
+                }
+            }
+        });
+}
+
+} // namespace imgdupl
@@ -0,0 +1,22 @@
+#ifndef __COMPONENTS_HPP_INCLUDED__
+#define __COMPONENTS_HPP_INCLUDED__
+
+#include <stddef.h>
+
+#include "hash_store.hpp"
+#include "scan_scheduler.hpp"
+#include "union_find.hpp"
+
+namespace imgdupl
+{
+
+// Unites every pair of images of the store which are within threshold of
+// each other. Pairs are found by HammingJoin with threads of the scheduler
+// and go straight into the union-find instead of being collected, so memory
+// doesn't depend on the number of pairs. Images with zero hashes failed to
+// load and are left alone.
+void unite_similar(const HashStore& store, int threshold, ScanScheduler& scheduler, ConcurrentUnionFind& components);
+
+} // namespace imgdupl
+
+#endif
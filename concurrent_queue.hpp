@@ -0,0 +1,111 @@
+#ifndef __CONCURRENT_QUEUE_HPP_INCLUDED__
+#define __CONCURRENT_QUEUE_HPP_INCLUDED__
+
+#include <stddef.h>
+
+#include <queue>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+
+namespace imgdupl
+{
+
+// Mutex protected FIFO queue. If capacity is non zero push() blocks while the
+// queue holds that many elements, so a fast producer can't outrun consumers.
+template <typename Data>
+class ConcurrentQueue
+{
+public:
+    typedef Data value_type;
+
+    ConcurrentQueue(size_t capacity_ = 0)
+        : capacity(capacity_)
+    {
+    }
+
+    void push(const Data& data)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (capacity != 0 && queue.size() >= capacity) {
+            not_full_condvar.wait(lock);
+        }
+
+        queue.push(data);
+        lock.unlock();
+        condvar.notify_one();
+    }
+
+    void push(Data&& data)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (capacity != 0 && queue.size() >= capacity) {
+            not_full_condvar.wait(lock);
+        }
+
+        queue.push(std::move(data));
+        lock.unlock();
+        condvar.notify_one();
+    }
+
+    bool empty() const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return queue.empty();
+    }
+
+    bool try_pop(Data& popped_value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (queue.empty()) {
+            return false;
+        }
+
+        popped_value = std::move(queue.front());
+        queue.pop();
+
+        lock.unlock();
+        not_full_condvar.notify_one();
+
+        return true;
+    }
+
+    void wait_and_pop(Data& popped_value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (queue.empty()) {
+            condvar.wait(lock);
+        }
+
+        popped_value = std::move(queue.front());
+        queue.pop();
+
+        lock.unlock();
+        not_full_condvar.notify_one();
+    }
+
+    size_t size() const
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        return queue.size();
+    }
+
+    ConcurrentQueue(ConcurrentQueue const&) = delete;
+    ConcurrentQueue& operator=(ConcurrentQueue const&) = delete;
+
+private:
+    std::queue<Data> queue;
+    size_t capacity;
+    mutable std::mutex mutex;
+    std::condition_variable condvar;
+    std::condition_variable not_full_condvar;
+};
+
+} // namespace
+
+#endif
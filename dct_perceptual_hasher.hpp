@@ -1,10 +1,11 @@
 #ifndef __DCT_PERCEPTUAL_HASHER_HPP_INCLUDED__
 #define __DCT_PERCEPTUAL_HASHER_HPP_INCLUDED__
 
-#include <vector>
 #include <string>
+#include <algorithm>
 
 #include <stdint.h>
+#include <string.h>
 
 #include <Magick++.h>
 #include <Eigen/Dense>
@@ -14,23 +15,51 @@
 namespace imgdupl
 {
 
+// Number of the first diagonals of a matrix which hold at least count
+// elements, the first count coefficients in zig-zag order come from the top
+// left square of this side.
+constexpr int
+zigzag_side(int count)
+{
+    int side = 0;
+
+    while (side * (side + 1) / 2 < count) {
+        side++;
+    }
+
+    return side;
+}
+
 template <int N, int Bits>
 class DCTHasher
 {
 public:
+    // side of a square image a hash is calculated on
+    static const int size = N;
+    static const int bits = Bits;
+
+    // pixels of an image in hash_batch() input
+    static const int pixels = N * N;
+
+    // side of the top left block of DCT coefficients hashes are made of
+    static const int coeffs_side = zigzag_side(Bits);
+
+    static_assert(coeffs_side <= N, "image is too small for that many bits");
+
+    typedef BasicPHash<Bits> Hash;
+
     DCTHasher()
     {
         make_dct_matrix();
-        dct_t = dct.transpose();
     }
 
     ~DCTHasher()
     {
     }
 
-    std::pair<bool, PHash> hash(const Magick::Image& original_image) const
+    std::pair<bool, Hash> hash(const Magick::Image& original_image) const
     {
-        PHash phash;
+        Hash phash {};
         bool status = true;
 
         try {
@@ -42,15 +71,67 @@ public:
         return std::make_pair(status, phash);
     }
 
+    // Hashes count grayscale images of N x N pixels from one contiguous arena:
+    // an image is N rows one after another and images follow each other.
+    // Pixels are floats or uint8_t, any scale will do. Hashes are written
+    // into the caller's array. Only the coefficients hashes are made of are
+    // calculated: images are multiplied by the first coeffs_side rows of the
+    // DCT matrix instead of the whole one, the first of the two products is
+    // done for many images at once as one large matrix product.
+    template <typename Pixel>
+    void hash_batch(const Pixel* pixels, size_t count, Hash* hashes) const
+    {
+        for (size_t first = 0; first < count; first += BATCH_SIZE) {
+            size_t n = std::min(count - first, BATCH_SIZE);
+
+            // column major N x N matrix of pixels of an image is the image
+            // transposed, so it's basis * image^T for every image
+            Eigen::Map<const Eigen::Matrix<Pixel, N, Eigen::Dynamic>> images(pixels + first * N * N, N, n * N);
+            Eigen::Matrix<float, coeffs_side, Eigen::Dynamic> rows = basis * images.template cast<float>();
+
+            for (size_t i = 0; i < n; i++) {
+                // DCT of the image transposed
+                Coeffs c = rows.middleCols(i * N, N) * basis_t;
+                hashes[first + i] = make_hash(c);
+            }
+        }
+    }
+
+    // Converts an image into N x N grayscale pixels for hash_batch(), throws
+    // Magick::Exception on errors. The image is resized in place, so pass a
+    // copy if it's still needed. The image is resized before it's converted
+    // to grayscale, so full size images aren't converted, and intensities are
+    // exported into pixels at once instead of being read pixel by pixel. The
+    // "I" export takes channels as they are, the conversion turns CMYK and
+    // other colorspaces into RGB first.
+    static void load_pixels(Magick::Image& image, float* pixels)
+    {
+        Magick::Geometry geometry(N, N);
+        geometry.aspect(true);
+
+        image.transform(geometry);
+        image.type(Magick::GrayscaleType);
+
+        image.write(0, 0, N, N, "I", Magick::FloatPixel, pixels);
+    }
+
 private:
-    typedef Eigen::Matrix<float, N, N> DCTMatrix;
-    typedef Eigen::Matrix<float, N, N> ImgMatrix;
+    // images per matrix product in hash_batch(), partial products of them fit
+    // in L2 cache
+    static const size_t BATCH_SIZE = 64;
+
+    typedef Eigen::Matrix<float, coeffs_side, N> Basis;
+    typedef Eigen::Matrix<float, N, coeffs_side> BasisT;
+    typedef Eigen::Matrix<float, coeffs_side, coeffs_side> Coeffs;
 
-    DCTMatrix dct;
-    DCTMatrix dct_t;
+    // the first coeffs_side rows of the DCT matrix
+    Basis basis;
+    BasisT basis_t;
 
     void make_dct_matrix()
     {
+        Eigen::Matrix<float, N, N> dct;
+
         unsigned int i, k, rows, cols;
 
         cols = dct.cols();
@@ -69,40 +150,32 @@ private:
                 dct(k, i) = c * cos((M_PI / (2 * n)) * k * (2 * i + 1));
             }
         }
+
+        basis = dct.template topRows<coeffs_side>();
+        basis_t = basis.transpose();
     }
 
-    PHash hash_impl(const Magick::Image& image_) const
+    Hash hash_impl(const Magick::Image& image_) const
     {
         Magick::Image image(image_);
 
-        image.type(Magick::GrayscaleType);
-
-        Magick::Geometry geometry(N, N);
-        geometry.aspect(true);
-
-        image.transform(geometry);
-
-        unsigned int width = image.size().width();
-        unsigned int height = image.size().height();
-
-        Magick::PixelPacket* pixels = image.getPixels(0, 0, width, height);
+        float pixels[N * N];
+        Hash phash;
 
-        ImgMatrix img;
+        load_pixels(image, pixels);
+        hash_batch(pixels, 1, &phash);
 
-        for (unsigned int i = 0; i < width; i++) {
-            for (unsigned int j = 0; j < height; j++) {
-                img(i, j) = static_cast<float>(pixels->red);
-                ++pixels;
-            }
-        }
-
-        DCTMatrix c = dct * img * dct_t;
+        return phash;
+    }
 
+    // c is the DCT of an image transposed
+    static Hash make_hash(const Coeffs& c)
+    {
         float coeffs[Bits];
         float coeffs_copy[Bits];
 
         for (int i = 0, j = 0, k = 0; k < Bits; k++) {
-            coeffs[k] = c(i, j);
+            coeffs[k] = c(j, i);
             j++;
             i--;
             if (i < 0) {
@@ -111,33 +184,21 @@ private:
             }
         }
 
+        // the two middle values are all the median needs, there is no need
+        // to sort everything
         memcpy(coeffs_copy, coeffs, sizeof(coeffs));
-        std::sort(coeffs_copy, coeffs_copy + Bits);
+        std::nth_element(coeffs_copy, coeffs_copy + Bits / 2, coeffs_copy + Bits);
 
-        float median = (coeffs_copy[Bits / 2] + coeffs_copy[Bits / 2 - 1]) / 2.0;
+        float median = (coeffs_copy[Bits / 2] + *std::max_element(coeffs_copy, coeffs_copy + Bits / 2)) / 2.0;
 
-        PHash phash;
+        Hash phash {};
 
-        uint64_t hash = 0;
-        int basic_hash_bits_count = sizeof(hash) * 8;
-        uint64_t one = 1;
+        const int basic_hash_bits_count = sizeof(uint64_t) * 8;
 
-        for (size_t i = 0; i < Bits; i++) {
+        for (int i = 0; i < Bits; i++) {
             if (coeffs[i] > median) {
-                hash |= one;
+                phash[i / basic_hash_bits_count] |= uint64_t(1) << (i % basic_hash_bits_count);
             }
-
-            one = one << 1;
-
-            if ((i + 1) % basic_hash_bits_count == 0) {
-                phash.push_back(hash);
-                hash = 0;
-                one = 1;
-            }
-        }
-
-        if (Bits % basic_hash_bits_count != 0) {
-            phash.push_back(hash);
         }
 
         return phash;
@@ -11,6 +11,11 @@
 #include "hash_delimeter.hpp"
 #include "tokenizer.hpp"
 #include "exc.hpp"
+#include "phash.hpp"
+#include "hash_store.hpp"
+#include "hashes_db.hpp"
+#include "hash_index.hpp"
+#include "clusters_db.hpp"
 
 using namespace imgdupl;
 
@@ -25,12 +30,21 @@ public:
     Args(int argc, char** argv)
     {
         data_type = argv[1];
-        THROW_EXC_IF_FAILED(
-            data_type == "hashes" || (data_type == "clusters" && argc == 5), "data type must be either 'hashes' or 'clusters'");
+
+        if (data_type == "migrate") {
+            db_file = argv[2];
+            return;
+        }
+
+        bool clusters = data_type == "clusters" || data_type == "clusters-append";
+
+        THROW_EXC_IF_FAILED(argc >= 4
+                && (data_type == "hashes" || data_type == "merge" || data_type == "index" || (clusters && argc == 5)),
+            "data type must be one of 'hashes', 'merge', 'clusters', 'clusters-append', 'index' or 'migrate'");
 
         data_file = argv[2];
         db_file = argv[3];
-        clusters_table = (data_type == "clusters" ? argv[4] : "");
+        clusters_table = (clusters ? argv[4] : "");
     }
 
     Args() = delete;
@@ -40,38 +54,35 @@ void
 usage(const char* program)
 {
     std::cout << "Usage: " << program << " <data_type> <data_file> <db_file> [<clusters_table>]" << std::endl;
+    std::cout << "       " << program << " migrate <db_file>" << std::endl;
     std::cout << std::endl << "Where:" << std::endl;
-    std::cout << "  data_type       -- string value, must be either 'hashes' or 'clusters'" << std::endl;
-    std::cout << "  data_file       -- file with data to export" << std::endl;
+    std::cout << "  data_type       -- string value, must be one of 'hashes', 'merge', 'clusters', 'clusters-append' or "
+                 "'index'"
+              << std::endl;
+    std::cout << "  data_file       -- file with data to export, for 'index' the index file to write, for 'merge' "
+                 "another database"
+              << std::endl;
     std::cout << "  db_file         -- SQLite database file" << std::endl;
     std::cout << "  clusters_table  -- name of a table in SQLite database with clusters" << std::endl;
+    std::cout << std::endl
+              << "'clusters-append' adds output of 'clusterizer --incremental' to an existing clusters table." << std::endl;
+    std::cout << "'merge' appends hashes of another database, e.g. one made on another node, images get new ids."
+              << std::endl;
+    std::cout << "'migrate' upgrades a database made by older versions: converts text hashes to BLOBs and adds "
+                 "new columns."
+              << std::endl;
 
     exit(0);
 }
 
-void
-create_hashes_table(sqlite3* db)
-{
-    std::string st = "CREATE TABLE hashes (id INTEGER PRIMARY KEY AUTOINCREMENT, hash TEXT, path TEXT)";
-    sqlite3_stmt* stmt = NULL;
-
-    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
-
-    rc = sqlite3_step(stmt);
-    THROW_EXC_IF_FAILED(rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
-
-    rc = sqlite3_finalize(stmt);
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
-}
-
 void
 create_clusters_table(sqlite3* db, const Args& args)
 {
     char st[512];
     sqlite3_stmt* stmt = NULL;
 
-    snprintf(st, sizeof(st), "CREATE TABLE %s (cluster_id INTEGER UNIQUE, count INTEGER, images TEXT)", args.clusters_table.c_str());
+    snprintf(st, sizeof(st), "CREATE TABLE %s %s (cluster_id INTEGER UNIQUE, count INTEGER, images TEXT)",
+        args.data_type == "clusters-append" ? "IF NOT EXISTS" : "", args.clusters_table.c_str());
 
     int rc = sqlite3_prepare_v2(db, st, strlen(st), &stmt, NULL);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
@@ -81,6 +92,15 @@ create_clusters_table(sqlite3* db, const Args& args)
 
     rc = sqlite3_finalize(stmt);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    // members left from a table with the same name which was dropped
+    if (args.data_type == "clusters") {
+        std::string drop_st = "DROP TABLE IF EXISTS " + members_table_name(args.clusters_table);
+        char* errmsg;
+
+        rc = sqlite3_exec(db, drop_st.c_str(), NULL, NULL, &errmsg);
+        THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+    }
 }
 
 sqlite3*
@@ -91,7 +111,7 @@ open_db(const Args& args)
     int rc = sqlite3_open_v2(args.db_file.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
 
-    if (args.data_type == "hashes") {
+    if (args.data_type == "hashes" || args.data_type == "merge") {
         create_hashes_table(db);
     } else {
         create_clusters_table(db, args);
@@ -113,41 +133,42 @@ fill_hashes_db(sqlite3* db, const Args& args)
     std::ifstream data(args.data_file.c_str(), std::ios::in);
     THROW_EXC_IF_FAILED(!data.fail(), "Couldn't open file \"%s\"", args.data_file.c_str());
 
-    std::string st = "INSERT INTO hashes (hash, path) VALUES(?, ?)";
-    sqlite3_stmt* stmt = NULL;
+    // a second export into the same database would add every image again
+    THROW_EXC_IF_FAILED(hashes_table_empty(db),
+        "database \"%s\" already has hashes, export into a new one or update it with imghash --incremental",
+        args.db_file.c_str());
 
-    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+    HashesInserter inserter(db);
 
     std::string line;
     Tokens tokens;
 
     char* errmsg;
 
-    rc = sqlite3_exec(db, "BEGIN", NULL, NULL, &errmsg);
+    int rc = sqlite3_exec(db, "BEGIN", NULL, NULL, &errmsg);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
 
-    while (std::getline(data, line)) {
-        tokenize(line, tokens, "\t");
+    // imghash starts a file with a line naming the algorithm, files made by
+    // older versions don't have it
+    HashAlgorithm algo = DEFAULT_HASH_ALGORITHM;
 
-        rc = sqlite3_bind_text(stmt, 1, tokens[0].c_str(), tokens[0].size(), SQLITE_TRANSIENT);
-        THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+    if (data.peek() == '#' && std::getline(data, line)) {
+        char name[64];
 
-        rc = sqlite3_bind_text(stmt, 2, tokens[1].c_str(), tokens[1].size(), SQLITE_TRANSIENT);
-        THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+        THROW_EXC_IF_FAILED(sscanf(line.c_str(), "# algo %63s bits %d", name, &algo.bits) == 2,
+            "invalid header line \"%s\"", line.c_str());
+        algo.name = name;
+    }
 
-        rc = sqlite3_step(stmt);
-        THROW_EXC_IF_FAILED(rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+    set_hash_algorithm(db, algo);
 
-        rc = sqlite3_reset(stmt);
-        THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_reset() failed: \"%s\"", sqlite3_errmsg(db));
+    while (std::getline(data, line)) {
+        tokenize(line, tokens, "\t");
+        inserter.insert(make_hash(tokens[0]), tokens[1]);
     }
 
     rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
-
-    rc = sqlite3_finalize(stmt);
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
 }
 
 void
@@ -182,6 +203,13 @@ fill_clusters_db(sqlite3* db, const Args& args)
 
     snprintf(st, sizeof(st), "INSERT INTO %s (cluster_id, count, images) VALUES(?, ?, ?)", args.clusters_table.c_str());
 
+    // new members of existing clusters go after the old ones, so the base
+    // image stays the first
+    if (args.data_type == "clusters-append") {
+        snprintf(st + strlen(st), sizeof(st) - strlen(st),
+            " ON CONFLICT(cluster_id) DO UPDATE SET count = count + excluded.count, images = images || ',' || excluded.images");
+    }
+
     int rc = sqlite3_prepare_v2(db, st, strlen(st), &stmt, NULL);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
 
@@ -193,6 +221,10 @@ fill_clusters_db(sqlite3* db, const Args& args)
     rc = sqlite3_exec(db, "BEGIN", NULL, NULL, &errmsg);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
 
+    create_members_table(db, args.clusters_table);
+
+    ClusterMembersInserter members(db, args.clusters_table);
+
     uint32_t cluster_id = 0, prev_cluster_id = 0;
     std::string images;
     uint32_t images_count = 0;
@@ -201,6 +233,7 @@ fill_clusters_db(sqlite3* db, const Args& args)
         tokenize(line, tokens, "\t");
 
         cluster_id = boost::lexical_cast<uint32_t>(tokens[1]);
+        members.insert(cluster_id, boost::lexical_cast<uint32_t>(tokens[0]));
 
         if (prev_cluster_id != 0 && cluster_id != prev_cluster_id) {
             insert_cluster(db, stmt, prev_cluster_id, images_count, images);
@@ -220,7 +253,11 @@ fill_clusters_db(sqlite3* db, const Args& args)
     }
 
     // insert last cluster
-    insert_cluster(db, stmt, cluster_id, images_count, images);
+    if (images_count > 0) {
+        insert_cluster(db, stmt, cluster_id, images_count, images);
+    }
+
+    index_members_table(db, args.clusters_table);
 
     rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
@@ -229,26 +266,216 @@ fill_clusters_db(sqlite3* db, const Args& args)
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
 }
 
+static int64_t
+count_rows(sqlite3* db, const std::string& st)
+{
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_ROW, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    int64_t count = sqlite3_column_int64(stmt, 0);
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    return count;
+}
+
+// Appends hashes which aren't removed from another database, e.g. one imghash
+// filled on another node, so all of them can be clusterized together. Rows
+// get new ids in this database, file attributes are kept for --incremental.
+void
+merge_hashes_db(sqlite3* db, const Args& args)
+{
+    sqlite3* src = NULL;
+
+    int rc = sqlite3_open_v2(args.data_file.c_str(), &src, SQLITE_OPEN_READONLY, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+
+    HashAlgorithm algo;
+    bool has_algo = false;
+    bool migrated = false;
+
+    try {
+        THROW_EXC_IF_FAILED(table_exists(src, "hashes"), "\"%s\" has no hashes table", args.data_file.c_str());
+
+        has_algo = read_hash_algorithm(src, algo);
+        migrated = table_has_column(src, "hashes", "removed")
+            && count_rows(src, "SELECT count(*) FROM hashes WHERE typeof(hash) <> 'blob'") == 0;
+    } catch (...) {
+        sqlite3_close(src);
+        throw;
+    }
+
+    sqlite3_close(src);
+
+    THROW_EXC_IF_FAILED(migrated, "\"%s\" is made by an older version, run 'export2db migrate' on it first",
+        args.data_file.c_str());
+
+    char* errmsg;
+
+    rc = sqlite3_exec(db, "BEGIN", NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+
+    if (has_algo) {
+        set_hash_algorithm(db, algo);
+    }
+
+    std::string st = "ATTACH DATABASE ? AS src";
+    sqlite3_stmt* stmt = NULL;
+
+    rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_text(stmt, 1, args.data_file.c_str(), args.data_file.size(), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    const char* merge = "INSERT INTO main.hashes (hash, path, size, mtime, inode) "
+                        "SELECT hash, path, size, mtime, inode FROM src.hashes WHERE removed = 0 ORDER BY id";
+
+    rc = sqlite3_exec(db, merge, NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+
+    int merged = sqlite3_changes(db);
+
+    rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+
+    rc = sqlite3_exec(db, "DETACH DATABASE src", NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+
+    std::cerr << "merged " << merged << " hashes" << std::endl;
+}
+
 void
 fill_db(sqlite3* db, const Args& args)
 {
     if (args.data_type == "hashes") {
         fill_hashes_db(db, args);
+    } else if (args.data_type == "merge") {
+        merge_hashes_db(db, args);
     } else {
         fill_clusters_db(db, args);
     }
 }
 
+// Hashes go the other way, from the database into a binary index file which
+// clusterizer maps into memory instead of parsing the database.
+void
+export_index(const Args& args)
+{
+    HashStore images;
+
+    read_hashes_from_db(args.db_file, images);
+    write_hash_index(args.data_file, images, read_hash_algorithm(args.db_file));
+}
+
+// SQL function which converts a text hash into a BLOB, BLOBs are returned as is.
+static void
+hash_blob_func(sqlite3_context* ctx, int, sqlite3_value** argv)
+{
+    if (sqlite3_value_type(argv[0]) == SQLITE_BLOB) {
+        sqlite3_result_value(ctx, argv[0]);
+        return;
+    }
+
+    try {
+        std::string text(reinterpret_cast<const char*>(sqlite3_value_text(argv[0])), sqlite3_value_bytes(argv[0]));
+        uint8_t blob[PHASH_BLOB_SIZE];
+
+        encode_hash_blob(make_hash(text), blob);
+        sqlite3_result_blob(ctx, blob, sizeof(blob), SQLITE_TRANSIENT);
+    } catch (std::exception& exc) {
+        sqlite3_result_error(ctx, exc.what(), -1);
+    }
+}
+
+// Converts text hashes of a database into BLOBs, ids of images are kept, so
+// existing clusters tables stay valid.
+void
+migrate_db(const Args& args)
+{
+    sqlite3* db = NULL;
+
+    int rc = sqlite3_open_v2(args.db_file.c_str(), &db, SQLITE_OPEN_READWRITE, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+
+    // adds columns newer versions keep file attributes in
+    create_hashes_table(db);
+
+    std::string st = "SELECT count(*) FROM hashes WHERE typeof(hash) <> 'blob'";
+    sqlite3_stmt* stmt = NULL;
+
+    rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_ROW, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    int64_t text_hashes = sqlite3_column_int64(stmt, 0);
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    if (text_hashes == 0) {
+        std::cerr << "hashes are already stored as BLOBs, nothing to migrate" << std::endl;
+        close_db(db);
+        return;
+    }
+
+    rc = sqlite3_create_function(db, "hash_blob", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, hash_blob_func, NULL, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_create_function() failed: \"%s\"", sqlite3_errmsg(db));
+
+    // BLOBs aren't affected by the TEXT affinity of the old column, so it's
+    // enough to convert values in place
+    const char* migration = "UPDATE hashes SET hash = hash_blob(hash) WHERE typeof(hash) <> 'blob'";
+
+    char* errmsg;
+
+    rc = sqlite3_exec(db, migration, NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+
+    // give space taken by text hashes back to the file system
+    rc = sqlite3_exec(db, "VACUUM", NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+
+    close_db(db);
+
+    std::cerr << "migrated " << text_hashes << " hashes" << std::endl;
+}
+
 int
 main(int argc, char** argv)
 {
-    if (argc < 4) {
+    if (argc < 3 || (argc < 4 && strcmp(argv[1], "migrate") != 0)) {
         usage(argv[0]);
     }
 
     try {
         Args args(argc, argv);
 
+        if (args.data_type == "index") {
+            export_index(args);
+            return EXIT_SUCCESS;
+        }
+
+        if (args.data_type == "migrate") {
+            sqlite3_initialize();
+            migrate_db(args);
+            sqlite3_shutdown();
+            return EXIT_SUCCESS;
+        }
+
         sqlite3_initialize();
         sqlite3* db = open_db(args);
         fill_db(db, args);
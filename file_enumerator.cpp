@@ -0,0 +1,102 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "file_enumerator.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+FileEnumerator::FileEnumerator(const std::string& root)
+    : skipped(0)
+{
+    THROW_EXC_IF_FAILED(push_directory(root), "opendir(\"%s\") failed: %s", root.c_str(), strerror(errno));
+}
+
+FileEnumerator::~FileEnumerator()
+{
+    for (auto& v : stack) {
+        closedir(v.first);
+    }
+}
+
+bool
+FileEnumerator::push_directory(const std::string& path)
+{
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL) {
+        return false;
+    }
+
+    stack.push_back(std::make_pair(dir, path));
+
+    return true;
+}
+
+bool
+FileEnumerator::next(std::string& path)
+{
+    while (!stack.empty()) {
+        struct dirent* entry = readdir(stack.back().first);
+
+        if (entry == NULL) {
+            closedir(stack.back().first);
+            stack.pop_back();
+            continue;
+        }
+
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        const std::string& parent = stack.back().second;
+
+        std::string entry_path;
+        entry_path.reserve(parent.size() + 1 + strlen(name));
+        entry_path.append(parent);
+        if (!parent.empty() && parent.back() != '/') {
+            entry_path.push_back('/');
+        }
+        entry_path.append(name);
+
+        unsigned char type = entry->d_type;
+
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(entry_path.c_str(), &st) != 0) {
+                continue;
+            }
+
+            if (S_ISDIR(st.st_mode)) {
+                type = DT_DIR;
+            } else if (S_ISREG(st.st_mode)) {
+                type = DT_REG;
+            } else if (S_ISLNK(st.st_mode)) {
+                type = DT_LNK;
+            }
+        }
+
+        if (type == DT_LNK) {
+            struct stat st;
+            if (stat(entry_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+
+            type = DT_REG;
+        }
+
+        if (type == DT_DIR) {
+            if (!push_directory(entry_path)) {
+                skipped++;
+            }
+        } else if (type == DT_REG) {
+            path = std::move(entry_path);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace imgdupl
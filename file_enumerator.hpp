@@ -0,0 +1,48 @@
+#ifndef __FILE_ENUMERATOR_HPP_INCLUDED__
+#define __FILE_ENUMERATOR_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <dirent.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace imgdupl
+{
+
+// Walks a directory tree once, depth first, in the same order as
+// boost::filesystem::recursive_directory_iterator does. File types are taken
+// from readdir()'s d_type, so stat() is called only for symbolic links and on
+// file systems which don't fill d_type in. Like the recursive iterator it
+// doesn't follow symbolic links to directories but reports symbolic links to
+// regular files.
+class FileEnumerator
+{
+public:
+    FileEnumerator(const std::string& root);
+    ~FileEnumerator();
+
+    // Stores path of the next regular file in the path argument, returns false
+    // when the whole tree has been walked.
+    bool next(std::string& path);
+
+    // number of subdirectories which couldn't be opened and were skipped
+    size_t skipped_directories() const
+    {
+        return skipped;
+    }
+
+    FileEnumerator(FileEnumerator const&) = delete;
+    FileEnumerator& operator=(FileEnumerator const&) = delete;
+
+private:
+    std::vector<std::pair<DIR*, std::string>> stack;
+    size_t skipped;
+
+    bool push_directory(const std::string& path);
+};
+
+} // namespace imgdupl
+
+#endif
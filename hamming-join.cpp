@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <iostream>
+
+#include <cxxopts.hpp>
+
+#include "exc.hpp"
+#include "hash_store.hpp"
+#include "hashes_db.hpp"
+#include "hash_index.hpp"
+#include "hamming_join.hpp"
+
+using namespace imgdupl;
+
+// Appends a line "<id1>\t<id2>\t<distance>" to the buffer.
+static void
+format_pair(std::vector<char>& buffer, uint32_t id1, uint32_t id2, uint32_t distance)
+{
+    char line[48];
+
+    int n = snprintf(line, sizeof(line), "%u\t%u\t%u\n", id1, id2, distance);
+    buffer.insert(buffer.end(), line, line + n);
+}
+
+int
+main(int argc, char** argv)
+{
+    try {
+        cxxopts::Options args(argv[0], "find all pairs of images within threshold of each other");
+
+        // clang-format off
+        args.add_options()
+            ("h,help", "show this help and exit")
+            ("data", "SQLite database or index file with perceptual hashes", cxxopts::value<std::string>())
+            ("threshold", "distance between two hashes", cxxopts::value<int>())
+            ("threads", "number of threads to run", cxxopts::value<int>())
+            ;
+        // clang-format on
+
+        args.parse_positional({"data", "threshold", "threads"});
+        args.positional_help("<data> <threshold> <threads>");
+
+        auto opts = args.parse(argc, argv);
+
+        if (opts.count("help") || opts.count("data") == 0 || opts.count("threshold") == 0 || opts.count("threads") == 0) {
+            std::cout << args.help() << std::endl;
+            std::cout << "Example: " << argv[0] << " hashes.db 10 8" << std::endl << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        auto threshold = opts["threshold"].as<int>();
+        auto threads_num = opts["threads"].as<int>();
+
+        if (threshold < 0 || threads_num <= 0) {
+            std::cerr << "invalid args: threshold can't be negative, threads can't be less than 1" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        auto data = opts["data"].as<std::string>();
+
+        std::unique_ptr<HashIndexFile> index_file;
+        HashStore images;
+
+        if (HashIndexFile::is_hash_index(data)) {
+            index_file.reset(new HashIndexFile(data));
+            index_file->attach(images);
+        } else {
+            read_hashes_from_db(data, images);
+        }
+
+        ScanScheduler scheduler(threads_num, 1);
+        std::vector<std::vector<char>> buffers(threads_num);
+        uint64_t pairs = 0;
+
+        auto started = std::chrono::steady_clock::now();
+
+        // a batch goes out with a single write, stdio locks the stream, so
+        // lines of different workers don't mix
+        HammingJoin::run(images.hashes(), images.size(), threshold, scheduler,
+            [&](int worker, const HammingPair* found, size_t count) {
+                auto& buffer = buffers[worker];
+
+                buffer.clear();
+                for (size_t k = 0; k < count; k++) {
+                    format_pair(buffer, images.image_id(found[k].i), images.image_id(found[k].j), found[k].distance);
+                }
+
+                fwrite(buffer.data(), 1, buffer.size(), stdout);
+                __atomic_fetch_add(&pairs, count, __ATOMIC_RELAXED);
+            });
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+        THROW_EXC_IF_FAILED(fflush(stdout) == 0 && !ferror(stdout), "failed to write pairs");
+
+        uint64_t comparisons = HammingJoin::comparisons(images.size());
+
+        std::cerr << images.size() << " images, " << pairs << " pairs within threshold, " << comparisons
+                  << " comparisons in " << elapsed.count() << " s (" << comparisons / elapsed.count() / threads_num / 1e6
+                  << " M comparisons/s per thread)" << std::endl;
+    } catch (std::exception& exc) {
+        std::cerr << "Error: " << exc.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <vector>
+
+#include "hamming_join.hpp"
+
+namespace imgdupl
+{
+
+static_assert(sizeof(PHash) == 16, "the join kernel expects 128 bit hashes");
+
+// rows of a tile kept in registers at once
+static const size_t ROWS = 4;
+
+// found pairs are passed to the sink in batches of this size
+static const size_t BATCH_SIZE = 4096;
+
+namespace
+{
+
+class PairBuffer
+{
+public:
+    PairBuffer(int worker_, const HammingJoin::Sink& sink_)
+        : worker(worker_)
+        , sink(sink_)
+    {
+    }
+
+    ~PairBuffer()
+    {
+        flush();
+    }
+
+    void add(size_t i, size_t j, int distance)
+    {
+        pairs.push_back(HammingPair{static_cast<uint32_t>(i), static_cast<uint32_t>(j), static_cast<uint32_t>(distance)});
+
+        if (pairs.size() == BATCH_SIZE) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (!pairs.empty()) {
+            sink(worker, pairs.data(), pairs.size());
+            pairs.clear();
+        }
+    }
+
+private:
+    int worker;
+    const HammingJoin::Sink& sink;
+    std::vector<HammingPair> pairs;
+};
+
+} // namespace
+
+static inline int
+dist(uint64_t a0, uint64_t a1, uint64_t b0, uint64_t b1)
+{
+    return __builtin_popcountll(a0 ^ b0) + __builtin_popcountll(a1 ^ b1);
+}
+
+void
+HammingJoin::join_tiles(const PHash* a,
+    size_t a_count,
+    size_t a_first,
+    const PHash* b,
+    size_t b_count,
+    size_t b_first,
+    bool diagonal,
+    int threshold,
+    int worker,
+    const Sink& sink)
+{
+    PairBuffer found(worker, sink);
+
+    size_t i = 0;
+
+    for (; i + ROWS <= a_count; i += ROWS) {
+        const uint64_t r00 = a[i][0], r01 = a[i][1];
+        const uint64_t r10 = a[i + 1][0], r11 = a[i + 1][1];
+        const uint64_t r20 = a[i + 2][0], r21 = a[i + 2][1];
+        const uint64_t r30 = a[i + 3][0], r31 = a[i + 3][1];
+
+        // on the diagonal columns up to i + 3 are compared with some of the
+        // rows only, they are masked out below
+        for (size_t j = diagonal ? i + 1 : 0; j < b_count; j++) {
+            const uint64_t c0 = b[j][0], c1 = b[j][1];
+
+            int d0 = dist(r00, r01, c0, c1);
+            int d1 = dist(r10, r11, c0, c1);
+            int d2 = dist(r20, r21, c0, c1);
+            int d3 = dist(r30, r31, c0, c1);
+
+            // matches are rare, so one well predicted branch for all rows
+            if (std::min(std::min(d0, d1), std::min(d2, d3)) > threshold) {
+                continue;
+            }
+
+            int d[ROWS] = {d0, d1, d2, d3};
+
+            for (size_t r = 0; r < ROWS; r++) {
+                if (d[r] <= threshold && (!diagonal || j > i + r)) {
+                    found.add(a_first + i + r, b_first + j, d[r]);
+                }
+            }
+        }
+    }
+
+    for (; i < a_count; i++) {
+        const uint64_t r0 = a[i][0], r1 = a[i][1];
+
+        for (size_t j = diagonal ? i + 1 : 0; j < b_count; j++) {
+            int d = dist(r0, r1, b[j][0], b[j][1]);
+
+            if (d <= threshold) {
+                found.add(a_first + i, b_first + j, d);
+            }
+        }
+    }
+}
+
+void
+HammingJoin::run(const PHash* hashes, size_t count, int threshold, ScanScheduler& scheduler, const Sink& sink)
+{
+    size_t tiles = (count + TILE_SIZE - 1) / TILE_SIZE;
+
+    // pairs (a, b), a <= b, are numbered row by row, row a starts at
+    // a * tiles - a * (a - 1) / 2
+    auto row_start = [tiles](size_t a) { return a * tiles - a * (a - 1) / 2; };
+
+    scheduler.run(0, row_start(tiles), [&](int worker, size_t begin, size_t end) {
+        // the last row which starts at or before begin
+        size_t lo = 0, hi = tiles;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (row_start(mid) <= begin) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+
+        size_t a = lo;
+        size_t b = a + (begin - row_start(a));
+
+        for (size_t k = begin; k < end; k++) {
+            size_t a_first = a * TILE_SIZE;
+            size_t b_first = b * TILE_SIZE;
+
+            join_tiles(hashes + a_first, std::min(TILE_SIZE, count - a_first), a_first, hashes + b_first,
+                std::min(TILE_SIZE, count - b_first), b_first, a == b, threshold, worker, sink);
+
+            if (++b == tiles) {
+                a++;
+                b = a;
+            }
+        }
+    });
+}
+
+} // namespace imgdupl
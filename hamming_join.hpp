@@ -0,0 +1,64 @@
+#ifndef __HAMMING_JOIN_HPP_INCLUDED__
+#define __HAMMING_JOIN_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+#include "phash.hpp"
+#include "scan_scheduler.hpp"
+
+namespace imgdupl
+{
+
+// Pair of positions (i < j) of hashes within threshold of each other.
+struct HammingPair {
+    uint32_t i;
+    uint32_t j;
+    uint32_t distance;
+};
+
+// Exact all-pairs join of hashes. Hashes are cut into tiles small enough for
+// two of them to stay in L1 cache, every pair of tiles is compared with a
+// register blocked XOR and popcount kernel which keeps several rows of one
+// tile in registers while streaming through the other. Pairs of tiles are
+// the chunks of work for threads of a scheduler, so it's best made with
+// chunk size 1. Pairs of one tile are consecutive chunks, which keeps the
+// tile in cache while a thread claims them.
+class HammingJoin
+{
+public:
+    // hashes per tile, 16 KiB
+    static const size_t TILE_SIZE = 1024;
+
+    // Gets found pairs in batches, concurrently from all workers.
+    typedef std::function<void(int worker, const HammingPair* pairs, size_t count)> Sink;
+
+    // Calls sink with every pair of hashes[0 ... count - 1] within threshold.
+    static void run(const PHash* hashes, size_t count, int threshold, ScanScheduler& scheduler, const Sink& sink);
+
+    // Number of pairs of hashes compared by run(), for throughput reports.
+    static uint64_t comparisons(size_t count)
+    {
+        return uint64_t(count) * (count - (count > 0)) / 2;
+    }
+
+    // Compares hashes of tiles a and b, a and b are the same for a tile on the
+    // diagonal, then only pairs i < j are compared. Positions of pairs are
+    // offset by a_first and b_first.
+    static void join_tiles(const PHash* a,
+        size_t a_count,
+        size_t a_first,
+        const PHash* b,
+        size_t b_count,
+        size_t b_first,
+        bool diagonal,
+        int threshold,
+        int worker,
+        const Sink& sink);
+};
+
+} // namespace imgdupl
+
+#endif
@@ -0,0 +1,151 @@
+#include <immintrin.h>
+
+#include "hamming_kernel.hpp"
+
+namespace imgdupl
+{
+
+// SIMD kernels below are written for two words long hashes: AVX2 register holds
+// two hashes, AVX-512 register holds four of them.
+static_assert(sizeof(PHash) == 16, "SIMD kernels expect 128 bit hashes");
+
+uint64_t
+match_block_scalar(const PHash& base, const PHash* hashes, size_t count, int threshold)
+{
+    uint64_t mask = 0;
+
+    if (threshold <= EARLY_REJECT_MAX_THRESHOLD) {
+        for (size_t i = 0; i < count; i++) {
+            if (within_distance(base, hashes[i], threshold)) {
+                mask |= uint64_t(1) << i;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            if (hamming_distance(base, hashes[i]) <= threshold) {
+                mask |= uint64_t(1) << i;
+            }
+        }
+    }
+
+    return mask;
+}
+
+// Population count of each 64 bit word with a nibble lookup table (Mula's
+// algorithm). Harley-Seal is faster only when counts of many words are summed
+// up, here we need a separate count for every hash.
+__attribute__((target("avx2"))) static inline __m256i
+popcount_epi64_avx2(__m256i v)
+{
+    // clang-format off
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    // clang-format on
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2"))) uint64_t
+match_block_avx2(const PHash& base, const PHash* hashes, size_t count, int threshold)
+{
+    const __m256i b = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(base.data())));
+    const __m256i t = _mm256_set1_epi64x(threshold);
+
+    uint64_t mask = 0;
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hashes + i));
+        __m256i d = popcount_epi64_avx2(_mm256_xor_si256(v, b));
+
+        // sum up counts of both words of a hash
+        d = _mm256_add_epi64(d, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        uint64_t gt = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(d, t)));
+        uint64_t le = ~gt;
+
+        mask |= ((le & 1) | ((le >> 1) & 2)) << i;
+    }
+
+    if (i < count) {
+        mask |= match_block_scalar(base, hashes + i, count - i, threshold) << i;
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq"))) uint64_t
+match_block_avx512(const PHash& base, const PHash* hashes, size_t count, int threshold)
+{
+    // zero masked forms of intrinsics are used since unmasked ones trigger
+    // false "used uninitialized" warnings in GCC headers
+    const __m512i b
+        = _mm512_maskz_broadcast_i32x4(0xffff, _mm_loadu_si128(reinterpret_cast<const __m128i*>(base.data())));
+    const __m512i t = _mm512_set1_epi64(threshold);
+
+    uint64_t mask = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m512i v = _mm512_loadu_si512(hashes + i);
+        __m512i d = _mm512_popcnt_epi64(_mm512_xor_si512(v, b));
+
+        // sum up counts of both words of a hash
+        d = _mm512_add_epi64(d, _mm512_maskz_shuffle_epi32(0xffff, d, _MM_PERM_BADC));
+
+        uint64_t le = _mm512_cmple_epi64_mask(d, t);
+
+        mask |= ((le & 1) | ((le >> 1) & 2) | ((le >> 2) & 4) | ((le >> 3) & 8)) << i;
+    }
+
+    if (i < count) {
+        mask |= match_block_scalar(base, hashes + i, count - i, threshold) << i;
+    }
+
+    return mask;
+}
+
+static MatchBlockFunc
+select_match_block_func(const char** name)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq")) {
+        *name = "avx512";
+        return match_block_avx512;
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return match_block_avx2;
+    }
+
+    *name = "scalar";
+    return match_block_scalar;
+}
+
+static const char* match_block_name = NULL;
+
+MatchBlockFunc
+match_block_func()
+{
+    static MatchBlockFunc func = select_match_block_func(&match_block_name);
+
+    return func;
+}
+
+const char*
+match_block_impl_name()
+{
+    match_block_func();
+
+    return match_block_name;
+}
+
+} // namespace imgdupl
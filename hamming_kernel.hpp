@@ -0,0 +1,30 @@
+#ifndef __HAMMING_KERNEL_HPP_INCLUDED__
+#define __HAMMING_KERNEL_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "phash.hpp"
+
+namespace imgdupl
+{
+
+// Compares base with count (at most 64) hashes, returns a mask where bit i is
+// set if the distance between base and hashes[i] is not greater than threshold.
+typedef uint64_t (*MatchBlockFunc)(const PHash& base, const PHash* hashes, size_t count, int threshold);
+
+uint64_t match_block_scalar(const PHash& base, const PHash* hashes, size_t count, int threshold);
+uint64_t match_block_avx2(const PHash& base, const PHash* hashes, size_t count, int threshold);
+uint64_t match_block_avx512(const PHash& base, const PHash* hashes, size_t count, int threshold);
+
+// The fastest implementation supported by the CPU we are running on, chosen
+// once on the first call.
+MatchBlockFunc match_block_func();
+
+// Name of the implementation returned by match_block_func(): "avx512", "avx2"
+// or "scalar".
+const char* match_block_impl_name();
+
+} // namespace imgdupl
+
+#endif
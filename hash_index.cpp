@@ -0,0 +1,144 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+
+#include "hash_index.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+static const char HASH_INDEX_MAGIC[8] = {'I', 'M', 'G', 'D', 'I', 'D', 'X', '\0'};
+static const uint32_t HASH_INDEX_VERSION = 2;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+void
+write_hash_index(const std::string& name, const HashStore& images, const HashAlgorithm& algo)
+{
+    THROW_EXC_IF_FAILED(algo.name.size() < sizeof(HashIndexHeader::algo), "algorithm name \"%s\" is too long",
+        algo.name.c_str());
+
+    HashIndexHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HASH_INDEX_MAGIC, sizeof(header.magic));
+    header.version = HASH_INDEX_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.bits = PHASH_BITS;
+    header.algo_bits = algo.bits;
+    header.count = images.size();
+    memcpy(header.algo, algo.name.data(), algo.name.size());
+
+    // readers never see a partially written file under the final name
+    std::string tmp_name = name + ".tmp";
+
+    std::ofstream out(tmp_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    THROW_EXC_IF_FAILED(!out.fail(), "Couldn't open file \"%s\"", tmp_name.c_str());
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(images.hashes()), images.size() * sizeof(PHash));
+    out.write(reinterpret_cast<const char*>(images.ids()), images.size() * sizeof(uint32_t));
+
+    out.close();
+    THROW_EXC_IF_FAILED(!out.fail(), "Couldn't write file \"%s\"", tmp_name.c_str());
+
+    int rc = rename(tmp_name.c_str(), name.c_str());
+    THROW_EXC_IF_FAILED(rc == 0, "rename() failed: %s", strerror(errno));
+}
+
+bool
+HashIndexFile::is_hash_index(const std::string& name)
+{
+    char magic[sizeof(HASH_INDEX_MAGIC)];
+
+    std::ifstream in(name.c_str(), std::ios::in | std::ios::binary);
+    in.read(magic, sizeof(magic));
+
+    return !in.fail() && memcmp(magic, HASH_INDEX_MAGIC, sizeof(magic)) == 0;
+}
+
+HashIndexFile::HashIndexFile(const std::string& name)
+    : data(MAP_FAILED)
+    , data_size(0)
+    , count(0)
+{
+    int fd = open(name.c_str(), O_RDONLY);
+    THROW_EXC_IF_FAILED(fd != -1, "open() failed on \"%s\": %s", name.c_str(), strerror(errno));
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        THROW_EXC("fstat() failed on \"%s\": %s", name.c_str(), strerror(err));
+    }
+
+    data_size = st.st_size;
+
+    if (data_size >= sizeof(HashIndexHeader)) {
+        data = mmap(NULL, data_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+    int err = errno;
+    close(fd);
+
+    THROW_EXC_IF_FAILED(data_size >= sizeof(HashIndexHeader), "\"%s\" is too short for an index file", name.c_str());
+    THROW_EXC_IF_FAILED(data != MAP_FAILED, "mmap() failed on \"%s\": %s", name.c_str(), strerror(err));
+
+    const HashIndexHeader* header = static_cast<const HashIndexHeader*>(data);
+
+    try {
+        THROW_EXC_IF_FAILED(memcmp(header->magic, HASH_INDEX_MAGIC, sizeof(header->magic)) == 0,
+            "\"%s\" isn't an index file", name.c_str());
+        // version 1 differs only by the algorithm missing from the header
+        THROW_EXC_IF_FAILED(header->version == HASH_INDEX_VERSION || header->version == 1,
+            "unsupported version %u of index file \"%s\"", header->version, name.c_str());
+        THROW_EXC_IF_FAILED(header->byte_order == BYTE_ORDER_MARK,
+            "index file \"%s\" was written on a machine with different byte order", name.c_str());
+        THROW_EXC_IF_FAILED(header->bits == PHASH_BITS, "index file \"%s\" has %u bit hashes, expected %d bit ones",
+            name.c_str(), header->bits, PHASH_BITS);
+
+        count = header->count;
+
+        if (header->version == 1) {
+            algo = DEFAULT_HASH_ALGORITHM;
+        } else {
+            algo.name = std::string(header->algo, strnlen(header->algo, sizeof(header->algo)));
+            algo.bits = header->algo_bits;
+
+            THROW_EXC_IF_FAILED(algo.bits > 0 && algo.bits <= PHASH_BITS,
+                "index file \"%s\" is truncated or corrupted", name.c_str());
+        }
+
+        THROW_EXC_IF_FAILED(count <= (data_size - sizeof(HashIndexHeader)) / (sizeof(PHash) + sizeof(uint32_t))
+                && data_size == sizeof(HashIndexHeader) + count * (sizeof(PHash) + sizeof(uint32_t)),
+            "index file \"%s\" is truncated or corrupted", name.c_str());
+    } catch (...) {
+        munmap(data, data_size);
+        throw;
+    }
+
+    // the whole file is going to be scanned soon
+    madvise(data, data_size, MADV_WILLNEED);
+}
+
+HashIndexFile::~HashIndexFile()
+{
+    munmap(data, data_size);
+}
+
+void
+HashIndexFile::attach(HashStore& images) const
+{
+    const char* hashes = static_cast<const char*>(data) + sizeof(HashIndexHeader);
+    const char* ids = hashes + count * sizeof(PHash);
+
+    images.attach(reinterpret_cast<const PHash*>(hashes), reinterpret_cast<const uint32_t*>(ids), count);
+}
+
+} // namespace imgdupl
@@ -0,0 +1,75 @@
+#ifndef __HASH_INDEX_HPP_INCLUDED__
+#define __HASH_INDEX_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "phash.hpp"
+#include "hash_store.hpp"
+
+namespace imgdupl
+{
+
+// Binary file with hashes of images which can be memory mapped and used as is,
+// without parsing. It consists of the header, count packed hashes of
+// bits / 8 bytes and count 32 bit image ids following them. Numbers are in
+// the byte order of the machine the file was written on, a file from a
+// machine with different byte order is detected by the header.
+struct HashIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t bits; // width of a stored hash
+    uint32_t algo_bits; // significant bits of the algorithm, 0 in version 1
+    uint64_t count;
+    // name of the hashing algorithm padded with zeros, empty in version 1
+    char algo[24];
+    // pads the header to a cache line, so hashes following it are aligned
+    uint8_t reserved[8];
+};
+
+static_assert(sizeof(HashIndexHeader) == 64, "hashes in an index file must be 64 byte aligned");
+
+// Writes hashes and ids of all images from the store into a new index file.
+void write_hash_index(const std::string& name, const HashStore& images, const HashAlgorithm& algo);
+
+// Read only memory mapping of an index file.
+class HashIndexFile
+{
+public:
+    HashIndexFile(const std::string& name);
+    ~HashIndexFile();
+
+    // true if the file starts with the index file magic
+    static bool is_hash_index(const std::string& name);
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // files of version 1 hold DEFAULT_HASH_ALGORITHM hashes
+    const HashAlgorithm& algorithm() const
+    {
+        return algo;
+    }
+
+    // Makes the store use hashes and ids straight from the mapping, the file
+    // must outlive the store.
+    void attach(HashStore& images) const;
+
+    HashIndexFile(HashIndexFile const&) = delete;
+    HashIndexFile& operator=(HashIndexFile const&) = delete;
+
+private:
+    void* data;
+    size_t data_size;
+    size_t count;
+    HashAlgorithm algo;
+};
+
+} // namespace imgdupl
+
+#endif
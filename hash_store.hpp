@@ -0,0 +1,201 @@
+#ifndef __HASH_STORE_HPP_INCLUDED__
+#define __HASH_STORE_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <vector>
+#include <new>
+
+#include "phash.hpp"
+
+namespace imgdupl
+{
+
+template <typename T, size_t Alignment>
+class AlignedAllocator
+{
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator()
+    {
+    }
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        void* p = NULL;
+
+        if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        free(p);
+    }
+
+    bool operator==(const AlignedAllocator&) const
+    {
+        return true;
+    }
+
+    bool operator!=(const AlignedAllocator&) const
+    {
+        return false;
+    }
+};
+
+// Images to clusterize kept as a structure of arrays: hashes are packed one
+// after another in a cache line aligned array, so distance kernels can stream
+// through them, image ids and "processed" flags live in separate arrays. Flags
+// are bits of 64 bit words, bit i of word k belongs to the image k * 64 + i.
+//
+// Hashes and ids are either owned by the store or borrowed from memory of
+// someone else, e.g. a memory mapped index file.
+class HashStore
+{
+public:
+    static const size_t BLOCK_SIZE = 64;
+
+    typedef std::vector<PHash, AlignedAllocator<PHash, 64>> Hashes;
+    typedef std::vector<uint32_t> Ids;
+
+    HashStore()
+        : hash_data(NULL)
+        , id_data(NULL)
+        , count(0)
+    {
+    }
+
+    // Makes the store use n hashes and ids from outside, they must outlive the
+    // store and hashes must be 64 byte aligned. Nothing can be added after.
+    void attach(const PHash* hashes_, const uint32_t* ids_, size_t n)
+    {
+        assert(count == 0);
+
+        hash_data = hashes_;
+        id_data = ids_;
+        count = n;
+
+        processed_flags.assign((n + BLOCK_SIZE - 1) / BLOCK_SIZE, 0);
+    }
+
+    void reserve(size_t n)
+    {
+        hash_values.reserve(n);
+        image_ids.reserve(n);
+        processed_flags.reserve((n + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    }
+
+    void push_back(const PHash& hash, uint32_t image_id)
+    {
+        assert(count == hash_values.size());
+
+        if (count % BLOCK_SIZE == 0) {
+            processed_flags.push_back(0);
+        }
+
+        hash_values.push_back(hash);
+        image_ids.push_back(image_id);
+
+        hash_data = hash_values.data();
+        id_data = image_ids.data();
+        count++;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    const PHash& hash(size_t i) const
+    {
+        return hash_data[i];
+    }
+
+    const PHash* hashes() const
+    {
+        return hash_data;
+    }
+
+    uint32_t image_id(size_t i) const
+    {
+        return id_data[i];
+    }
+
+    const uint32_t* ids() const
+    {
+        return id_data;
+    }
+
+    bool processed(size_t i) const
+    {
+        return (processed_flags[i / BLOCK_SIZE] >> (i % BLOCK_SIZE)) & 1;
+    }
+
+    void mark_processed(size_t i)
+    {
+        processed_flags[i / BLOCK_SIZE] |= uint64_t(1) << (i % BLOCK_SIZE);
+    }
+
+    // processed flags of images block * 64 ... block * 64 + 63
+    uint64_t processed_block(size_t block) const
+    {
+        return processed_flags[block];
+    }
+
+    void mark_processed_block(size_t block, uint64_t mask)
+    {
+        processed_flags[block] |= mask;
+    }
+
+    // index of the first not processed image starting from i, size() if all
+    // of them are processed
+    size_t next_unprocessed(size_t i) const
+    {
+        size_t size = count;
+
+        while (i < size) {
+            uint64_t free = ~processed_flags[i / BLOCK_SIZE] >> (i % BLOCK_SIZE);
+            if (free != 0) {
+                i += __builtin_ctzll(free);
+                return i < size ? i : size;
+            }
+            i = (i / BLOCK_SIZE + 1) * BLOCK_SIZE;
+        }
+
+        return size;
+    }
+
+    HashStore(HashStore const&) = delete;
+    HashStore& operator=(HashStore const&) = delete;
+
+private:
+    Hashes hash_values;
+    Ids image_ids;
+    std::vector<uint64_t> processed_flags;
+
+    const PHash* hash_data;
+    const uint32_t* id_data;
+    size_t count;
+};
+
+} // namespace imgdupl
+
+#endif
@@ -0,0 +1,148 @@
+#include <algorithm>
+
+#include "hasher_registry.hpp"
+#include "dct_perceptual_hasher.hpp"
+#include "simple_hashers.hpp"
+#include "image_hash.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+const char* const DEFAULT_HASHER = "dct50-128";
+
+// hashes a hasher produces at once into its own hash type before they are
+// widened to PHash
+static const size_t WIDEN_CHUNK = 64;
+
+template <typename Hasher>
+class RegisteredHasher : public ImageHasher
+{
+public:
+    static_assert(Hasher::bits <= PHASH_BITS, "hashes don't fit into PHash");
+
+    RegisteredHasher(const std::string& name_)
+        : algo(name_)
+    {
+    }
+
+    const std::string& name() const override
+    {
+        return algo;
+    }
+
+    int bits() const override
+    {
+        return Hasher::bits;
+    }
+
+    size_t pixels() const override
+    {
+        return Hasher::pixels;
+    }
+
+    bool read_pixels(const std::string& image_file, bool shrink_on_load, float* p) const override
+    {
+        return read_image_pixels<Hasher>(image_file, shrink_on_load, p);
+    }
+
+    void hash_batch(const float* p, size_t count, PHash* hashes) const override
+    {
+        hash_batch_into(p, count, hashes);
+    }
+
+private:
+    Hasher hasher;
+    std::string algo;
+
+    void hash_batch_into(const float* p, size_t count, typename Hasher::Hash* hashes) const
+    {
+        hasher.hash_batch(p, count, hashes);
+    }
+
+    template <typename Wide>
+    void hash_batch_into(const float* p, size_t count, Wide* hashes) const
+    {
+        typename Hasher::Hash narrow[WIDEN_CHUNK];
+
+        for (size_t i = 0; i < count; i += WIDEN_CHUNK) {
+            size_t n = std::min(WIDEN_CHUNK, count - i);
+
+            hasher.hash_batch(p + i * Hasher::pixels, n, narrow);
+
+            for (size_t k = 0; k < n; k++) {
+                Wide& hash = hashes[i + k];
+
+                hash.fill(0);
+                std::copy(narrow[k].begin(), narrow[k].end(), hash.begin());
+            }
+        }
+    }
+};
+
+template <typename Hasher>
+static std::unique_ptr<ImageHasher>
+make_registered(const std::string& name)
+{
+    return std::unique_ptr<ImageHasher>(new RegisteredHasher<Hasher>(name));
+}
+
+struct HasherEntry {
+    const char* name;
+    std::unique_ptr<ImageHasher> (*make)(const std::string& name);
+};
+
+// DCT hashes are named after the side of the image they are calculated on and
+// their bits. 256 bit variants aren't here since hashes are stored as 128 bit
+// PHash values everywhere.
+static const HasherEntry HASHERS[] = {
+    {"dct32-64", make_registered<DCTHasher<32, 64>>},
+    {"dct32-128", make_registered<DCTHasher<32, 128>>},
+    {"dct50-64", make_registered<DCTHasher<50, 64>>},
+    {"dct50-128", make_registered<DCTHasher<50, 128>>},
+    {"dct64-64", make_registered<DCTHasher<64, 64>>},
+    {"dct64-128", make_registered<DCTHasher<64, 128>>},
+    {"ahash-64", make_registered<AverageHasher<8>>},
+    {"dhash-64", make_registered<DifferenceHasher<8>>},
+};
+
+std::pair<bool, PHash>
+ImageHasher::hash_file(const std::string& image_file, bool shrink_on_load) const
+{
+    std::vector<float> p(pixels());
+    PHash phash {};
+
+    if (!read_pixels(image_file, shrink_on_load, p.data())) {
+        return std::make_pair(false, phash);
+    }
+
+    hash_batch(p.data(), 1, &phash);
+
+    return std::make_pair(true, phash);
+}
+
+std::unique_ptr<ImageHasher>
+make_hasher(const std::string& name)
+{
+    for (auto& entry : HASHERS) {
+        if (name == entry.name) {
+            return entry.make(name);
+        }
+    }
+
+    THROW_EXC("unknown hashing algorithm '%s'", name.c_str());
+}
+
+std::vector<std::string>
+hasher_names()
+{
+    std::vector<std::string> names;
+
+    for (auto& entry : HASHERS) {
+        names.push_back(entry.name);
+    }
+
+    return names;
+}
+
+} // namespace imgdupl
@@ -0,0 +1,59 @@
+#ifndef __HASHER_REGISTRY_HPP_INCLUDED__
+#define __HASHER_REGISTRY_HPP_INCLUDED__
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "phash.hpp"
+
+namespace imgdupl
+{
+
+// Hashing algorithm picked at run time. Every one is a hasher template
+// instantiated with its parameters, so kernels are specialized at compile
+// time and the only indirection is a virtual call per batch of images.
+class ImageHasher
+{
+public:
+    virtual ~ImageHasher()
+    {
+    }
+
+    // name the hasher is looked up by, e.g. "dct50-128"
+    virtual const std::string& name() const = 0;
+
+    // Significant bits of a hash. Hashes narrower than PHASH_BITS are padded
+    // with zero bits which don't affect distances.
+    virtual int bits() const = 0;
+
+    // floats an image takes in a hash_batch() arena
+    virtual size_t pixels() const = 0;
+
+    // Reads an image file and converts it into pixels for hash_batch(), false
+    // if the file couldn't be read.
+    virtual bool read_pixels(const std::string& image_file, bool shrink_on_load, float* pixels) const = 0;
+
+    // Hashes count images following each other in the arena.
+    virtual void hash_batch(const float* pixels, size_t count, PHash* hashes) const = 0;
+
+    // Reads an image file and hashes it, status is false if the file couldn't
+    // be read.
+    std::pair<bool, PHash> hash_file(const std::string& image_file, bool shrink_on_load) const;
+};
+
+// hasher imghash uses unless told otherwise, the one all hashes were made
+// with before the choice existed
+extern const char* const DEFAULT_HASHER;
+
+// Throws if there is no hasher with such name.
+std::unique_ptr<ImageHasher> make_hasher(const std::string& name);
+
+std::vector<std::string> hasher_names();
+
+} // namespace imgdupl
+
+#endif
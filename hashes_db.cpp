@@ -0,0 +1,559 @@
+#include <sys/stat.h>
+
+#include "hashes_db.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+// rows handed to the writer thread at once
+static const size_t BATCH_SIZE = 4096;
+
+// batches waiting for the writer thread, when the database can't keep up
+// callers block
+static const size_t MAX_PENDING_BATCHES = 64;
+
+// rows committed in one transaction
+static const size_t ROWS_PER_TRANSACTION = 1 << 17;
+
+bool
+get_file_stat(const std::string& path, FileStat& st)
+{
+    struct stat sb;
+
+    if (stat(path.c_str(), &sb) != 0) {
+        return false;
+    }
+
+    st.size = sb.st_size;
+    st.mtime = int64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    st.inode = sb.st_ino;
+
+    return true;
+}
+
+void
+read_hashes_from_db(const std::string& name, HashStore& images)
+{
+    sqlite3* db = NULL;
+
+    int rc = sqlite3_initialize();
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_initialize() failed");
+
+    rc = sqlite3_open_v2(name.c_str(), &db, SQLITE_OPEN_READONLY, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+
+    // tables made by older versions have no removed column
+    std::string st = "SELECT id, hash FROM hashes";
+    if (table_has_column(db, "hashes", "removed")) {
+        st += " WHERE removed = 0";
+    }
+
+    sqlite3_stmt* stmt = NULL;
+
+    rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    for (;;) {
+        rc = sqlite3_step(stmt);
+        THROW_EXC_IF_FAILED(rc == SQLITE_ROW || rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+        if (rc == SQLITE_DONE) {
+            break;
+        }
+
+        uint32_t image_id = sqlite3_column_int(stmt, 0);
+
+        // databases made by older versions of export2db keep hashes as text
+        if (sqlite3_column_type(stmt, 1) == SQLITE_BLOB) {
+            images.push_back(decode_hash_blob(sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1)), image_id);
+        } else {
+            std::string hash_data
+                = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)), sqlite3_column_bytes(stmt, 1));
+            images.push_back(make_hash(hash_data), image_id);
+        }
+    }
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    sqlite3_close(db);
+    sqlite3_shutdown();
+}
+
+// columns added to the hashes table since its first version
+static const char* const EXTRA_COLUMNS[][2] = {
+    {"size", "INTEGER"},
+    {"mtime", "INTEGER"},
+    {"inode", "INTEGER"},
+    {"removed", "INTEGER NOT NULL DEFAULT 0"},
+};
+
+void
+create_hashes_table(sqlite3* db)
+{
+    std::string st = "CREATE TABLE IF NOT EXISTS hashes (id INTEGER PRIMARY KEY AUTOINCREMENT, hash BLOB, path TEXT";
+    for (auto& column : EXTRA_COLUMNS) {
+        st += std::string(", ") + column[0] + " " + column[1];
+    }
+    st += ")";
+
+    char* errmsg;
+
+    int rc = sqlite3_exec(db, st.c_str(), NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+
+    for (auto& column : EXTRA_COLUMNS) {
+        if (!table_has_column(db, "hashes", column[0])) {
+            st = std::string("ALTER TABLE hashes ADD COLUMN ") + column[0] + " " + column[1];
+
+            rc = sqlite3_exec(db, st.c_str(), NULL, NULL, &errmsg);
+            THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+        }
+    }
+
+    st = "CREATE TABLE IF NOT EXISTS metadata (key TEXT PRIMARY KEY, value TEXT)";
+
+    rc = sqlite3_exec(db, st.c_str(), NULL, NULL, &errmsg);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+}
+
+bool
+table_has_column(sqlite3* db, const std::string& table, const std::string& column)
+{
+    std::string st = "SELECT count(*) FROM pragma_table_info(?) WHERE name = ?";
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_text(stmt, 1, table.c_str(), table.size(), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_text(stmt, 2, column.c_str(), column.size(), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_ROW, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    bool found = sqlite3_column_int(stmt, 0) > 0;
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    return found;
+}
+
+bool
+table_exists(sqlite3* db, const std::string& table)
+{
+    std::string st = "SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = ?";
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_text(stmt, 1, table.c_str(), table.size(), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_ROW, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    bool found = sqlite3_column_int(stmt, 0) > 0;
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    return found;
+}
+
+void
+read_known_files(sqlite3* db, KnownFiles& files)
+{
+    std::string st = "SELECT id, path, size, mtime, inode FROM hashes WHERE removed = 0";
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    for (;;) {
+        rc = sqlite3_step(stmt);
+        THROW_EXC_IF_FAILED(rc == SQLITE_ROW || rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+        if (rc == SQLITE_DONE) {
+            break;
+        }
+
+        std::string path
+            = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)), sqlite3_column_bytes(stmt, 1));
+
+        KnownFile file;
+
+        file.id = sqlite3_column_int64(stmt, 0);
+        file.has_stat = sqlite3_column_type(stmt, 2) != SQLITE_NULL;
+        file.stat.size = sqlite3_column_int64(stmt, 2);
+        file.stat.mtime = sqlite3_column_int64(stmt, 3);
+        file.stat.inode = sqlite3_column_int64(stmt, 4);
+
+        files[path] = file;
+    }
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+// false if the key isn't in the metadata table
+static bool
+read_metadata(sqlite3* db, const std::string& key, std::string& value)
+{
+    std::string st = "SELECT value FROM metadata WHERE key = ?";
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_text(stmt, 1, key.c_str(), key.size(), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_ROW || rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    bool found = rc == SQLITE_ROW;
+    if (found) {
+        value = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), sqlite3_column_bytes(stmt, 0));
+    }
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    return found;
+}
+
+static void
+write_metadata(sqlite3* db, const std::string& key, const std::string& value)
+{
+    std::string st = "INSERT OR REPLACE INTO metadata (key, value) VALUES(?, ?)";
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_text(stmt, 1, key.c_str(), key.size(), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_text(stmt, 2, value.c_str(), value.size(), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+bool
+hashes_table_empty(sqlite3* db)
+{
+    if (!table_exists(db, "hashes")) {
+        return true;
+    }
+
+    std::string st = "SELECT count(*) FROM (SELECT 1 FROM hashes LIMIT 1)";
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_ROW, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    bool empty = sqlite3_column_int(stmt, 0) == 0;
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+
+    return empty;
+}
+
+HashAlgorithm
+read_hash_algorithm(const std::string& name)
+{
+    sqlite3* db = NULL;
+
+    int rc = sqlite3_open_v2(name.c_str(), &db, SQLITE_OPEN_READONLY, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+
+    HashAlgorithm algo = DEFAULT_HASH_ALGORITHM;
+
+    try {
+        read_hash_algorithm(db, algo);
+    } catch (...) {
+        sqlite3_close(db);
+        throw;
+    }
+
+    sqlite3_close(db);
+
+    return algo;
+}
+
+bool
+read_hash_algorithm(sqlite3* db, HashAlgorithm& algo)
+{
+    std::string name, bits;
+
+    if (table_exists(db, "metadata") && read_metadata(db, "algo", name) && read_metadata(db, "bits", bits)) {
+        algo.name = name;
+        algo.bits = std::stoi(bits);
+        return true;
+    }
+
+    if (!hashes_table_empty(db)) {
+        algo = DEFAULT_HASH_ALGORITHM;
+        return true;
+    }
+
+    return false;
+}
+
+void
+set_hash_algorithm(sqlite3* db, const HashAlgorithm& algo)
+{
+    HashAlgorithm existing;
+
+    if (read_hash_algorithm(db, existing)) {
+        THROW_EXC_IF_FAILED(existing == algo, "database holds %s hashes (%d bits), can't add %s ones (%d bits)",
+            existing.name.c_str(), existing.bits, algo.name.c_str(), algo.bits);
+    }
+
+    write_metadata(db, "algo", algo.name);
+    write_metadata(db, "bits", std::to_string(algo.bits));
+}
+
+HashesInserter::HashesInserter(sqlite3* db_)
+    : db(db_)
+    , insert_stmt(NULL)
+    , remove_stmt(NULL)
+{
+    std::string st = "INSERT INTO hashes (hash, path, size, mtime, inode) VALUES(?, ?, ?, ?, ?)";
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &insert_stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    st = "UPDATE hashes SET removed = 1 WHERE id = ?";
+
+    rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &remove_stmt, NULL);
+    if (rc != SQLITE_OK) {
+        sqlite3_finalize(insert_stmt);
+        THROW_EXC("sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+    }
+}
+
+HashesInserter::~HashesInserter()
+{
+    sqlite3_finalize(insert_stmt);
+    sqlite3_finalize(remove_stmt);
+}
+
+void
+HashesInserter::insert(const PHash& hash, const std::string& path, const FileStat* stat)
+{
+    uint8_t blob[PHASH_BLOB_SIZE];
+
+    encode_hash_blob(hash, blob);
+
+    int rc = sqlite3_bind_blob(insert_stmt, 1, blob, sizeof(blob), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_blob() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_text(insert_stmt, 2, path.c_str(), path.size(), SQLITE_STATIC);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_text() failed: \"%s\"", sqlite3_errmsg(db));
+
+    if (stat != NULL) {
+        rc = sqlite3_bind_int64(insert_stmt, 3, stat->size);
+        THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_int64() failed: \"%s\"", sqlite3_errmsg(db));
+
+        rc = sqlite3_bind_int64(insert_stmt, 4, stat->mtime);
+        THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_int64() failed: \"%s\"", sqlite3_errmsg(db));
+
+        rc = sqlite3_bind_int64(insert_stmt, 5, stat->inode);
+        THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_int64() failed: \"%s\"", sqlite3_errmsg(db));
+    } else {
+        for (int i = 3; i <= 5; i++) {
+            rc = sqlite3_bind_null(insert_stmt, i);
+            THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_null() failed: \"%s\"", sqlite3_errmsg(db));
+        }
+    }
+
+    rc = sqlite3_step(insert_stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_reset(insert_stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_reset() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+void
+HashesInserter::mark_removed(int64_t id)
+{
+    int rc = sqlite3_bind_int64(remove_stmt, 1, id);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_int64() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_step(remove_stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_reset(remove_stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_reset() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+HashesDbWriter::HashesDbWriter(const std::string& name)
+    : db(NULL)
+    , batches(MAX_PENDING_BATCHES)
+    , closed(false)
+{
+    int rc = sqlite3_open_v2(name.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+
+    try {
+        create_hashes_table(db);
+    } catch (...) {
+        sqlite3_close(db);
+        throw;
+    }
+
+    batch.reserve(BATCH_SIZE);
+
+    writer = std::thread(&HashesDbWriter::write_batches, this);
+}
+
+HashesDbWriter::~HashesDbWriter()
+{
+    try {
+        close();
+    } catch (...) {
+    }
+}
+
+void
+HashesDbWriter::read_known_files(KnownFiles& files)
+{
+    imgdupl::read_known_files(db, files);
+}
+
+bool
+HashesDbWriter::empty()
+{
+    return hashes_table_empty(db);
+}
+
+void
+HashesDbWriter::set_hash_algorithm(const HashAlgorithm& algo)
+{
+    imgdupl::set_hash_algorithm(db, algo);
+}
+
+void
+HashesDbWriter::add(const PHash& hash, const std::string& path, const FileStat& stat, int64_t replaces)
+{
+    push_row(Row {replaces, true, hash, path, stat});
+}
+
+void
+HashesDbWriter::remove(int64_t id)
+{
+    push_row(Row {id, false, PHash(), std::string(), FileStat()});
+}
+
+void
+HashesDbWriter::push_row(Row&& row)
+{
+    batch.push_back(std::move(row));
+
+    if (batch.size() == BATCH_SIZE) {
+        batches.push(std::move(batch));
+
+        batch = Batch();
+        batch.reserve(BATCH_SIZE);
+    }
+}
+
+void
+HashesDbWriter::close()
+{
+    if (closed) {
+        return;
+    }
+
+    closed = true;
+
+    if (!batch.empty()) {
+        batches.push(std::move(batch));
+    }
+    batches.push(Batch());
+
+    writer.join();
+
+    sqlite3_close(db);
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void
+HashesDbWriter::write_batches()
+{
+    Batch rows;
+    size_t uncommitted = 0;
+    bool quit = false;
+
+    try {
+        HashesInserter inserter(db);
+        char* errmsg;
+
+        for (;;) {
+            batches.wait_and_pop(rows);
+            if (rows.empty()) {
+                quit = true;
+                break;
+            }
+
+            if (uncommitted == 0) {
+                int rc = sqlite3_exec(db, "BEGIN", NULL, NULL, &errmsg);
+                THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+            }
+
+            for (auto& row : rows) {
+                if (row.remove_id != 0) {
+                    inserter.mark_removed(row.remove_id);
+                }
+                if (row.insert) {
+                    inserter.insert(row.hash, row.path, &row.stat);
+                }
+            }
+
+            uncommitted += rows.size();
+
+            if (uncommitted >= ROWS_PER_TRANSACTION) {
+                int rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
+                THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+                uncommitted = 0;
+            }
+        }
+
+        if (uncommitted > 0) {
+            int rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
+            THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_exec() failed: \"%s\"", errmsg);
+        }
+    } catch (...) {
+        error = std::current_exception();
+
+        if (uncommitted > 0) {
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        }
+
+        // keep draining the queue, so the caller never blocks on it
+        while (!quit) {
+            batches.wait_and_pop(rows);
+            quit = rows.empty();
+        }
+    }
+}
+
+} // namespace imgdupl
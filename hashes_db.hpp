@@ -0,0 +1,157 @@
+#ifndef __HASHES_DB_HPP_INCLUDED__
+#define __HASHES_DB_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <exception>
+#include <unordered_map>
+
+#include <sqlite3.h>
+
+#include "phash.hpp"
+#include "hash_store.hpp"
+#include "concurrent_queue.hpp"
+
+namespace imgdupl
+{
+
+// Attributes of an image file stored next to its hash, a file with the same
+// ones is considered unchanged and isn't hashed again.
+struct FileStat {
+    int64_t size;
+    int64_t mtime; // nanoseconds since the epoch
+    int64_t inode;
+
+    bool operator==(const FileStat& other) const
+    {
+        return size == other.size && mtime == other.mtime && inode == other.inode;
+    }
+};
+
+// false if the file can't be stat()ed
+bool get_file_stat(const std::string& path, FileStat& st);
+
+// Image which is already in the hashes table.
+struct KnownFile {
+    int64_t id;
+    bool has_stat; // rows written by export2db have no file attributes
+    FileStat stat;
+};
+
+// not removed rows of the hashes table by their paths
+typedef std::unordered_map<std::string, KnownFile> KnownFiles;
+
+// Loads ids and hashes of all images which aren't marked as removed from the
+// hashes table of a SQLite database created by export2db or imghash.
+void read_hashes_from_db(const std::string& name, HashStore& images);
+
+// Creates the hashes table unless the database already has it and adds
+// columns which older versions didn't have to an existing one.
+void create_hashes_table(sqlite3* db);
+
+bool table_has_column(sqlite3* db, const std::string& table, const std::string& column);
+
+bool table_exists(sqlite3* db, const std::string& table);
+
+void read_known_files(sqlite3* db, KnownFiles& files);
+
+// true if the database has no hashes table or it has no rows, removed ones
+// included
+bool hashes_table_empty(sqlite3* db);
+
+// Algorithm of hashes of a database read_hashes_from_db() loads,
+// DEFAULT_HASH_ALGORITHM if the database has no record and no hashes.
+HashAlgorithm read_hash_algorithm(const std::string& name);
+
+// Algorithm recorded in the metadata table. Databases made before it existed
+// which have hashes are assumed to hold DEFAULT_HASH_ALGORITHM ones, false if
+// there is neither a record nor hashes.
+bool read_hash_algorithm(sqlite3* db, HashAlgorithm& algo);
+
+// Records the algorithm of hashes about to be added, throws if the database
+// already holds hashes of another one since they can't be compared.
+void set_hash_algorithm(sqlite3* db, const HashAlgorithm& algo);
+
+// Prepared statements changing the hashes table, hashes are stored as BLOBs.
+// Callers take care of transactions.
+class HashesInserter
+{
+public:
+    HashesInserter(sqlite3* db);
+    ~HashesInserter();
+
+    // stat may be NULL if attributes of the file are unknown
+    void insert(const PHash& hash, const std::string& path, const FileStat* stat = NULL);
+
+    void mark_removed(int64_t id);
+
+    HashesInserter(HashesInserter const&) = delete;
+    HashesInserter& operator=(HashesInserter const&) = delete;
+
+private:
+    sqlite3* db;
+    sqlite3_stmt* insert_stmt;
+    sqlite3_stmt* remove_stmt;
+};
+
+// Writes hashes into a database in the background: rows are collected into
+// batches which a dedicated thread inserts in large transactions, so callers
+// don't wait for SQLite.
+class HashesDbWriter
+{
+public:
+    HashesDbWriter(const std::string& name);
+    ~HashesDbWriter();
+
+    // Rows currently in the table, call before adding anything.
+    void read_known_files(KnownFiles& files);
+
+    // whether the table has no rows at all, see hashes_table_empty()
+    bool empty();
+
+    // Call before adding anything too, see set_hash_algorithm().
+    void set_hash_algorithm(const HashAlgorithm& algo);
+
+    // replaces is an id of a row this one supersedes, it's marked as
+    // removed, 0 if there is no such row
+    void add(const PHash& hash, const std::string& path, const FileStat& stat, int64_t replaces = 0);
+
+    void remove(int64_t id);
+
+    // Waits until everything added is committed, rethrows an error the writer
+    // thread failed with, if any.
+    void close();
+
+    HashesDbWriter(HashesDbWriter const&) = delete;
+    HashesDbWriter& operator=(HashesDbWriter const&) = delete;
+
+private:
+    struct Row {
+        int64_t remove_id; // row to mark as removed, 0 if none
+        bool insert; // whether to insert the hash
+        PHash hash;
+        std::string path;
+        FileStat stat;
+    };
+
+    // an empty batch tells the writer thread to quit
+    typedef std::vector<Row> Batch;
+
+    sqlite3* db;
+    Batch batch;
+    ConcurrentQueue<Batch> batches;
+    std::thread writer;
+    std::exception_ptr error;
+    bool closed;
+
+    void push_row(Row&& row);
+    void write_batches();
+};
+
+} // namespace imgdupl
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __IMAGE_HASH_HPP_INCLUDED__
+#define __IMAGE_HASH_HPP_INCLUDED__
+
+#include <string>
+#include <utility>
+
+#include <Magick++.h>
+
+namespace imgdupl
+{
+
+// Reads an image file and converts it into pixels for Hasher::hash_batch(),
+// false if the file couldn't be read.
+template <typename Hasher>
+bool
+read_image_pixels(const std::string& image_file, bool shrink_on_load, float* pixels)
+{
+    Magick::Image image;
+
+    try {
+        if (shrink_on_load) {
+            // Size hint lets decoders which support it produce a reduced image
+            // straight away, e.g. JPEG decoder picks the largest of 1/2, 1/4
+            // and 1/8 DCT scaling factors which still gives an image not
+            // smaller than the hint. Hasher downscales it further anyway.
+            image.read(Magick::Geometry(Hasher::size, Hasher::size), image_file);
+        } else {
+            image.read(image_file.c_str());
+        }
+        image.trim();
+
+        Hasher::load_pixels(image, pixels);
+    } catch (Magick::Exception&) {
+        return false;
+    }
+
+    return true;
+}
+
+// Reads an image file and calculates its hash with the hasher, status is false
+// if the file couldn't be read or hashed.
+template <typename Hasher>
+std::pair<bool, typename Hasher::Hash>
+calc_image_hash(const std::string& image_file, const Hasher& hasher, bool shrink_on_load)
+{
+    float pixels[Hasher::pixels];
+    typename Hasher::Hash phash {};
+
+    if (!read_image_pixels<Hasher>(image_file, shrink_on_load, pixels)) {
+        return std::make_pair(false, phash);
+    }
+
+    hasher.hash_batch(pixels, 1, &phash);
+
+    return std::make_pair(true, phash);
+}
+
+} // namespace imgdupl
+
+#endif
@@ -4,26 +4,177 @@
 #include <string>
 #include <utility>
 #include <tuple>
+#include <map>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <unordered_set>
 
 #include <boost/filesystem.hpp>
 
+#include <Magick++.h>
+
 #include <cxxopts.hpp>
 #include <spdlog/spdlog.h>
 #include <indicators/progress_bar.hpp>
 #include <indicators/cursor_control.hpp>
 
-#include "dct_perceptual_hasher.hpp"
+#include "hasher_registry.hpp"
 #include "hash_delimeter.hpp"
+#include "concurrent_queue.hpp"
+#include "file_enumerator.hpp"
+#include "hashes_db.hpp"
+#include "exc.hpp"
 
 using namespace imgdupl;
-using Hasher = DCTHasher<50, 64 * 2>;
 
 namespace fs = boost::filesystem;
 
-std::pair<bool, PHash> calc_image_hash(const std::string& image_file, const Hasher& hasher);
-void process_file(const fs::path& file, const Hasher& hasher, std::ofstream& result);
-void process_directory(std::string directory, const Hasher& hasher, std::ofstream& result);
-size_t get_files_count(std::string directory);
+enum class OutputOrder {
+    Deterministic, // same order as files were found in a directory
+    Completed // in order hashes were calculated
+};
+
+struct HashingOptions {
+    int threads_num;
+    OutputOrder order;
+    bool shrink_on_load; // let a decoder downscale an image while reading it
+    const KnownFiles* known_files; // files not to hash again if unchanged, may be NULL
+};
+
+struct HashJob {
+    size_t seq;
+    std::string filename; // empty filename tells a worker to quit
+};
+
+struct HashResult {
+    size_t seq;
+    bool status;
+    PHash phash;
+    std::string filename; // empty filename means that a worker has quit
+    FileStat stat;
+    int64_t known_id; // id of the file in the database, 0 if it's new there
+    bool unchanged; // known file which wasn't hashed again
+};
+
+// Destination of calculated hashes.
+class ResultSink
+{
+public:
+    virtual ~ResultSink()
+    {
+    }
+
+    virtual void write(const HashResult& r) = 0;
+
+    // Makes sure everything written is stored, throws otherwise. walk_complete
+    // is true if every file of the data set has been written.
+    virtual void close(bool walk_complete) = 0;
+};
+
+// Text file for export2db, a line per image after a header line naming the
+// hashing algorithm.
+class TextResultSink : public ResultSink
+{
+public:
+    TextResultSink(std::ofstream& out_, const ImageHasher& hasher)
+        : out(out_)
+    {
+        out << "# algo " << hasher.name() << " bits " << hasher.bits() << '\n';
+    }
+
+    void write(const HashResult& r) override;
+
+    void close(bool) override
+    {
+        out.flush();
+        THROW_EXC_IF_FAILED(!out.fail(), "couldn't write the result file");
+    }
+
+private:
+    std::ofstream& out;
+};
+
+// Hashes table of a SQLite database, rows are inserted in background. In
+// incremental mode rows of changed files are replaced and rows of files which
+// are gone are marked as removed.
+class DbResultSink : public ResultSink
+{
+public:
+    DbResultSink(const std::string& name, bool incremental, const ImageHasher& hasher);
+
+    // NULL unless in incremental mode
+    const KnownFiles* known_files() const
+    {
+        return incremental ? &known : NULL;
+    }
+
+    void write(const HashResult& r) override;
+    void close(bool walk_complete) override;
+
+private:
+    HashesDbWriter writer;
+    bool incremental;
+    KnownFiles known;
+    std::unordered_set<int64_t> seen_ids;
+    size_t unchanged;
+    size_t changed;
+};
+
+typedef ConcurrentQueue<HashJob> HashJobsQueue;
+typedef ConcurrentQueue<HashResult> HashResultsQueue;
+
+// Progress of a directory walk, total number of files is known only when the
+// walk is over.
+struct WalkProgress {
+    std::atomic<size_t> found {0};
+    std::atomic<bool> done {false};
+    std::atomic<bool> complete {false}; // no directory was skipped
+};
+
+// Jobs the producer may hand out in deterministic order: sequence numbers
+// below the next result to write plus size. Results which arrive ahead of
+// that one wait in memory, so a slow file would let them pile up without
+// limit otherwise.
+class SeqWindow
+{
+public:
+    SeqWindow(size_t size_)
+        : size(size_)
+        , next(0)
+    {
+    }
+
+    void wait_for(size_t seq)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        moved.wait(lock, [&] { return seq < next + size; });
+    }
+
+    // next is the sequence number of the next result to write
+    void advance(size_t next_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            next = next_;
+        }
+        moved.notify_one();
+    }
+
+private:
+    size_t size;
+    size_t next;
+    std::mutex mutex;
+    std::condition_variable moved;
+};
+
+void process_file(const fs::path& file, const ImageHasher& hasher, ResultSink& result, const HashingOptions& options);
+bool process_directory(
+    std::string directory, const ImageHasher& hasher, ResultSink& result, const HashingOptions& options);
 
 std::ostream&
 operator<<(std::ostream& out, const PHash& phash)
@@ -34,46 +185,235 @@ operator<<(std::ostream& out, const PHash& phash)
 }
 
 void
-process_file(const fs::path& file, const Hasher& hasher, std::ofstream& result)
+TextResultSink::write(const HashResult& r)
 {
-    std::string filename = file.string();
+    out << r.phash << '\t' << r.filename << '\n';
+}
 
-    bool status;
-    PHash phash;
+DbResultSink::DbResultSink(const std::string& name, bool incremental_, const ImageHasher& hasher)
+    : writer(name)
+    , incremental(incremental_)
+    , unchanged(0)
+    , changed(0)
+{
+    // otherwise every image would get a second row and look like a duplicate
+    // of itself
+    THROW_EXC_IF_FAILED(incremental || writer.empty(),
+        "database '%s' already has hashes, pass --incremental to update them", name.c_str());
+
+    writer.set_hash_algorithm(HashAlgorithm {hasher.name(), hasher.bits()});
+
+    if (incremental) {
+        writer.read_known_files(known);
+        spdlog::info("{} files are in the database already", known.size());
+    }
+}
+
+void
+DbResultSink::write(const HashResult& r)
+{
+    if (r.known_id != 0) {
+        seen_ids.insert(r.known_id);
+    }
+
+    if (r.unchanged) {
+        unchanged++;
+        return;
+    }
+
+    if (r.known_id != 0) {
+        changed++;
+    }
+
+    writer.add(r.phash, r.filename, r.stat, r.known_id);
+}
+
+void
+DbResultSink::close(bool walk_complete)
+{
+    size_t removed = 0;
+
+    // Files which weren't seen are gone, unless the walk missed them. Rows of
+    // changed files which couldn't be hashed again are removed as well.
+    if (incremental && walk_complete) {
+        for (auto& v : known) {
+            if (seen_ids.count(v.second.id) == 0) {
+                writer.remove(v.second.id);
+                removed++;
+            }
+        }
+    }
+
+    writer.close();
+
+    if (incremental) {
+        spdlog::info("{} files unchanged, {} changed, {} removed", unchanged, changed, removed);
+        if (!walk_complete) {
+            spdlog::warn("not all files were found, rows of missing files are kept");
+        }
+    }
+}
 
-    std::tie(status, phash) = calc_image_hash(filename, hasher);
-    if (status) {
-        result << phash << '\t' << filename << std::endl;
+void
+write_result(const HashResult& r, ResultSink& result)
+{
+    if (r.status) {
+        result.write(r);
     } else {
-        spdlog::error("failed at '{}'", filename);
+        spdlog::error("failed at '{}'", r.filename);
     }
 }
 
-size_t
-get_files_count(std::string directory)
+// Fills in attributes of the file, false if it doesn't have to be hashed:
+// it's known and hasn't changed since it was hashed or it can't be stat()ed.
+bool
+needs_hashing(const std::string& filename, const HashingOptions& options, HashResult& r)
 {
-    size_t count = 0;
+    r.known_id = 0;
+    r.unchanged = false;
 
-    fs::path root(directory);
-    fs::recursive_directory_iterator cur_iter(root), end_iter;
+    if (!get_file_stat(filename, r.stat)) {
+        r.status = false;
+        return false;
+    }
 
-    for (; cur_iter != end_iter; ++cur_iter) {
-        if (fs::exists(cur_iter->path()) && fs::is_regular_file(cur_iter->path())) {
-            count++;
+    if (options.known_files != NULL) {
+        auto it = options.known_files->find(filename);
+        if (it != options.known_files->end()) {
+            r.known_id = it->second.id;
+
+            if (it->second.has_stat && it->second.stat == r.stat) {
+                r.status = true;
+                r.unchanged = true;
+                return false;
+            }
         }
     }
 
-    return count;
+    return true;
 }
 
 void
-process_directory(std::string directory, const Hasher& hasher, std::ofstream& result)
+process_file(const fs::path& file, const ImageHasher& hasher, ResultSink& result, const HashingOptions& options)
 {
-    auto total = get_files_count(directory);
-    if (total == 0) {
-        return;
+    HashResult r;
+
+    r.seq = 0;
+    r.filename = file.string();
+
+    if (needs_hashing(r.filename, options, r)) {
+        std::tie(r.status, r.phash) = hasher.hash_file(r.filename, options.shrink_on_load);
     }
 
+    write_result(r, result);
+}
+
+// Images a worker decodes before hashing all of them with one call.
+const size_t IMAGES_PER_BATCH = 16;
+
+// Decodes images of the jobs which are in the queue already into an arena of
+// pixels, up to IMAGES_PER_BATCH of them, and hashes them as a batch. A
+// worker doesn't wait for more jobs to fill a batch up.
+void
+hashing_worker(const ImageHasher& hasher, const HashingOptions& options, HashJobsQueue& jobs, HashResultsQueue& results)
+{
+    const size_t image_size = hasher.pixels();
+
+    std::vector<float> arena(IMAGES_PER_BATCH * image_size);
+    std::vector<PHash> hashes(IMAGES_PER_BATCH);
+
+    std::vector<HashResult> batch;
+    std::vector<size_t> decoded; // results with pixels in the arena
+
+    HashJob job;
+    bool quit = false;
+
+    while (!quit) {
+        batch.clear();
+        decoded.clear();
+
+        jobs.wait_and_pop(job);
+
+        for (;;) {
+            if (job.filename.empty()) {
+                quit = true;
+                break;
+            }
+
+            HashResult r;
+
+            r.seq = job.seq;
+            r.filename = std::move(job.filename);
+
+            if (needs_hashing(r.filename, options, r)) {
+                float* pixels = arena.data() + decoded.size() * image_size;
+
+                r.status = hasher.read_pixels(r.filename, options.shrink_on_load, pixels);
+                if (r.status) {
+                    decoded.push_back(batch.size());
+                }
+            }
+
+            batch.push_back(std::move(r));
+
+            if (batch.size() == IMAGES_PER_BATCH || !jobs.try_pop(job)) {
+                break;
+            }
+        }
+
+        hasher.hash_batch(arena.data(), decoded.size(), hashes.data());
+
+        for (size_t i = 0; i < decoded.size(); i++) {
+            batch[decoded[i]].phash = hashes[i];
+        }
+
+        for (auto& r : batch) {
+            results.push(std::move(r));
+        }
+    }
+
+    results.push(HashResult {0, false, PHash(), std::string(), FileStat(), 0, false});
+}
+
+// window is NULL unless results are written in deterministic order
+void
+walk_directory(std::string directory, int threads_num, HashJobsQueue& jobs, WalkProgress& progress, SeqWindow* window)
+{
+    try {
+        FileEnumerator files(directory);
+        std::string filename;
+
+        for (size_t seq = 0; files.next(filename); seq++) {
+            if (window != NULL) {
+                window->wait_for(seq);
+            }
+
+            progress.found++;
+            jobs.push(HashJob {seq, std::move(filename)});
+        }
+
+        if (files.skipped_directories() > 0) {
+            spdlog::warn("couldn't open {} directories", files.skipped_directories());
+        }
+
+        progress.complete = files.skipped_directories() == 0;
+    } catch (std::exception& exc) {
+        spdlog::error("{}", exc.what());
+    }
+
+    progress.done = true;
+
+    for (int i = 0; i < threads_num; i++) {
+        jobs.push(HashJob {0, std::string()});
+    }
+}
+
+// Returns true if the whole directory tree has been walked.
+bool
+process_directory(std::string directory, const ImageHasher& hasher, ResultSink& result, const HashingOptions& options)
+{
+    auto threads_num = options.threads_num;
+
     // clang-format off
     indicators::ProgressBar pb {
         indicators::option::BarWidth {80},
@@ -84,47 +424,85 @@ process_directory(std::string directory, const Hasher& hasher, std::ofstream& re
         indicators::option::End {"]"},
         indicators::option::ForegroundColor {indicators::Color::white},
         indicators::option::FontStyles {std::vector<indicators::FontStyle> {indicators::FontStyle::bold}},
-        indicators::option::MaxProgress{total}
+        indicators::option::MaxProgress{1}
     };
     // clang-format on
 
-    fs::path root(directory);
-    fs::recursive_directory_iterator cur_iter(root), end_iter;
-
-    for (size_t processed = 0; cur_iter != end_iter; ++cur_iter) {
-        const auto& file = cur_iter->path();
-        if (fs::exists(file) && fs::is_regular_file(file)) {
-            process_file(file, hasher, result);
-            processed++;
-            pb.set_option(indicators::option::PostfixText {
-                "Processing: " + std::to_string(processed) + "/" + std::to_string(total)});
-            pb.tick();
-        }
+    // bounded queues keep memory usage flat when the producer or the workers
+    // are much faster than the consumer
+    size_t queue_capacity = 64 * threads_num;
+
+    HashJobsQueue jobs(queue_capacity);
+    HashResultsQueue results(queue_capacity);
+
+    WalkProgress progress;
+
+    // results of a window's worth of jobs at most wait for a slow file, as
+    // many as can be in the queue and in batches of workers anyway
+    SeqWindow window(queue_capacity + threads_num * IMAGES_PER_BATCH);
+    SeqWindow* ordering = options.order == OutputOrder::Deterministic ? &window : NULL;
+
+    auto started = std::chrono::steady_clock::now();
+
+    std::thread producer(walk_directory, directory, threads_num, std::ref(jobs), std::ref(progress), ordering);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads_num; i++) {
+        workers.emplace_back(
+            hashing_worker, std::cref(hasher), std::cref(options), std::ref(jobs), std::ref(results));
     }
 
-    indicators::show_console_cursor(true);
-}
+    // results which arrived before their predecessors in deterministic mode
+    std::map<size_t, HashResult> pending;
+    size_t next_seq = 0;
 
-std::pair<bool, PHash>
-calc_image_hash(const std::string& image_file, const Hasher& hasher)
-{
-    PHash phash;
-    bool status = true;
+    HashResult r;
 
-    Magick::Image image;
+    size_t processed = 0;
 
-    try {
-        image.read(image_file.c_str());
-        image.trim();
-    } catch (Magick::Exception&) {
-        status = false;
-        goto end;
+    for (size_t running = threads_num; running > 0;) {
+        results.wait_and_pop(r);
+        if (r.filename.empty()) {
+            running--;
+            continue;
+        }
+
+        if (options.order == OutputOrder::Completed) {
+            write_result(r, result);
+        } else {
+            pending.emplace(r.seq, std::move(r));
+            for (auto it = pending.begin(); it != pending.end() && it->first == next_seq; it = pending.erase(it)) {
+                write_result(it->second, result);
+                next_seq++;
+            }
+            window.advance(next_seq);
+        }
+
+        processed++;
+
+        // until the walk is over keep the bar a step behind the number of files
+        // found so far, otherwise it would be completed prematurely
+        bool done = progress.done;
+        size_t total = progress.found;
+
+        pb.set_option(indicators::option::MaxProgress {done ? total : total + 1});
+        pb.set_option(indicators::option::PostfixText {
+            "Processing: " + std::to_string(processed) + "/" + std::to_string(total) + (done ? "" : "+")});
+        pb.tick();
     }
 
-    std::tie(status, phash) = hasher.hash(image);
+    producer.join();
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    indicators::show_console_cursor(true);
 
-end:
-    return std::make_pair(status, phash);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    spdlog::info("processed {} files in {:.2f} seconds, {:.1f} files/sec", processed, elapsed.count(),
+        elapsed.count() > 0 ? processed / elapsed.count() : 0.0);
+
+    return progress.complete;
 }
 
 int
@@ -137,6 +515,15 @@ main(int argc, char** argv)
         ("h,help","show this help and exit")
         ("d,data", "path to a single image file or a directory with images", cxxopts::value<std::string>())
         ("r,result", "result file", cxxopts::value<std::string>())
+        ("db", "SQLite database to write hashes into instead of the result file", cxxopts::value<std::string>())
+        ("i,incremental", "with --db hash only files which are new or changed since the previous run and mark "
+            "deleted ones as removed")
+        ("t,threads", "number of hashing threads", cxxopts::value<int>()->default_value("1"))
+        ("o,order", "order of results: 'deterministic' or 'completed'", cxxopts::value<std::string>()->default_value("deterministic"))
+        ("s,shrink-on-load", "let decoder downscale images while reading them, much faster on large JPEGs, "
+            "but hashes may slightly differ from ones calculated on fully decoded images")
+        ("a,algo", "hashing algorithm: " + fmt::format("{}", fmt::join(hasher_names(), ", ")),
+            cxxopts::value<std::string>()->default_value(DEFAULT_HASHER))
         ;
     // clang-format on
 
@@ -147,30 +534,84 @@ main(int argc, char** argv)
         return EXIT_SUCCESS;
     }
 
-    if ((opts.count("data") == 0 && opts.count("d") == 0) || (opts.count("result") == 0 && opts.count("r") == 0)) {
-        spdlog::error("you have to specify --data and --result parameters. Run with --help for help.");
+    if ((opts.count("data") == 0 && opts.count("d") == 0) || (opts.count("result") == 0 && opts.count("db") == 0)) {
+        spdlog::error("you have to specify --data and either --result or --db parameters. Run with --help for help.");
         return EXIT_FAILURE;
     }
 
-    Magick::InitializeMagick(nullptr);
+    if (opts.count("result") > 0 && opts.count("db") > 0) {
+        spdlog::error("--result and --db parameters are mutually exclusive");
+        return EXIT_FAILURE;
+    }
 
-    std::ofstream result(opts["result"].as<std::string>().c_str());
-    if (result.fail()) {
-        spdlog::error("couldn't open file '{}' for writting!", opts["result"].as<std::string>());
+    bool incremental = opts.count("incremental") > 0;
+    if (incremental && opts.count("db") == 0) {
+        spdlog::error("--incremental requires --db parameter");
         return EXIT_FAILURE;
     }
 
-    Hasher hasher;
-    auto path = opts["data"].as<std::string>();
+    auto threads_num = opts["threads"].as<int>();
+    if (threads_num <= 0) {
+        spdlog::error("number of threads can't be less than 1");
+        return EXIT_FAILURE;
+    }
 
-    if (fs::exists(path)) {
-        if (fs::is_regular_file(path)) {
-            process_file(path, hasher, result);
-        } else if (fs::is_directory(path)) {
-            process_directory(path, hasher, result);
-        }
+    HashingOptions options;
+
+    options.threads_num = threads_num;
+    options.shrink_on_load = opts.count("shrink-on-load") > 0;
+    options.known_files = NULL;
+
+    auto order_name = opts["order"].as<std::string>();
+    if (order_name == "deterministic") {
+        options.order = OutputOrder::Deterministic;
+    } else if (order_name == "completed") {
+        options.order = OutputOrder::Completed;
     } else {
-        spdlog::error("'{}' does not exist!\n", path);
+        spdlog::error("invalid order '{}': must be either 'deterministic' or 'completed'", order_name);
+        return EXIT_FAILURE;
+    }
+
+    Magick::InitializeMagick(nullptr);
+
+    std::ofstream result_file;
+    std::unique_ptr<ResultSink> result;
+
+    try {
+        auto hasher = make_hasher(opts["algo"].as<std::string>());
+        spdlog::info("hashing with {} ({} bits)", hasher->name(), hasher->bits());
+
+        if (opts.count("db") > 0) {
+            auto db = new DbResultSink(opts["db"].as<std::string>(), incremental, *hasher);
+            result.reset(db);
+            options.known_files = db->known_files();
+        } else {
+            result_file.open(opts["result"].as<std::string>().c_str());
+            if (result_file.fail()) {
+                spdlog::error("couldn't open file '{}' for writting!", opts["result"].as<std::string>());
+                return EXIT_FAILURE;
+            }
+            result.reset(new TextResultSink(result_file, *hasher));
+        }
+
+        auto path = opts["data"].as<std::string>();
+
+        bool walk_complete = false;
+
+        if (fs::exists(path)) {
+            if (fs::is_regular_file(path)) {
+                process_file(path, *hasher, *result, options);
+            } else if (fs::is_directory(path)) {
+                walk_complete = process_directory(path, *hasher, *result, options);
+            }
+        } else {
+            spdlog::error("'{}' does not exist!\n", path);
+            return EXIT_FAILURE;
+        }
+
+        result->close(walk_complete);
+    } catch (std::exception& exc) {
+        spdlog::error("{}", exc.what());
         return EXIT_FAILURE;
     }
 
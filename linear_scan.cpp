@@ -0,0 +1,94 @@
+#include <assert.h>
+
+#include <algorithm>
+
+#include "linear_scan.hpp"
+#include "hamming_kernel.hpp"
+
+namespace imgdupl
+{
+
+void
+scan_range(const PHash& base,
+    HashStore& store,
+    size_t begin,
+    size_t end,
+    int threshold,
+    std::vector<size_t>& found,
+    bool extract)
+{
+    assert(begin < end);
+
+    const size_t block_size = HashStore::BLOCK_SIZE;
+    const MatchBlockFunc match_block = match_block_func();
+
+    for (size_t block = begin / block_size; block * block_size < end; block++) {
+        size_t first = block * block_size;
+        size_t last = std::min(first + block_size, end);
+
+        uint64_t candidates = extract ? ~store.processed_block(block) : ~uint64_t(0);
+        if (first < begin) {
+            candidates &= ~uint64_t(0) << (begin - first);
+        }
+        if (last - first < block_size) {
+            candidates &= (uint64_t(1) << (last - first)) - 1;
+        }
+
+        // whole block is processed already, e.g. it holds seeds of previous clusters
+        if (candidates == 0) {
+            continue;
+        }
+
+        uint64_t matched = match_block(base, store.hashes() + first, last - first, threshold) & candidates;
+        if (matched == 0) {
+            continue;
+        }
+
+        if (extract) {
+            store.mark_processed_block(block, matched);
+        }
+
+        for (; matched != 0; matched &= matched - 1) {
+            found.push_back(first + __builtin_ctzll(matched));
+        }
+    }
+}
+
+LinearScanner::LinearScanner(HashStore& store_, int threads_num)
+    : store(store_)
+    , scheduler(threads_num, CHUNK_SIZE)
+    , found_by_worker(threads_num)
+{
+    static_assert(CHUNK_SIZE % HashStore::BLOCK_SIZE == 0, "chunks must consist of whole blocks");
+}
+
+void
+LinearScanner::scan(const PHash& base,
+    size_t begin,
+    size_t end,
+    int threshold,
+    std::vector<size_t>& found,
+    bool extract)
+{
+    for (auto& v : found_by_worker) {
+        v.clear();
+    }
+
+    scheduler.run(begin, end, [&](int worker, size_t chunk_begin, size_t chunk_end) {
+        scan_range(base, store, chunk_begin, chunk_end, threshold, found_by_worker[worker], extract);
+    });
+
+    size_t first = found.size();
+
+    for (auto& v : found_by_worker) {
+        found.insert(found.end(), v.begin(), v.end());
+    }
+
+    // every worker finds positions in ascending order, but chunks are spread
+    // among workers arbitrarily
+    if (scheduler.threads() > 1) {
+        std::sort(found.begin() + first, found.end());
+    }
+}
+
+} // namespace imgdupl
@@ -0,0 +1,69 @@
+#ifndef __LINEAR_SCAN_HPP_INCLUDED__
+#define __LINEAR_SCAN_HPP_INCLUDED__
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "phash.hpp"
+#include "hash_store.hpp"
+#include "scan_scheduler.hpp"
+#include "cluster_index.hpp"
+
+namespace imgdupl
+{
+
+// Marks not processed images from [begin, end) range which are close enough to
+// the base hash as processed and appends their positions to found. Ranges
+// scanned concurrently must not share blocks of the store, since processed
+// flags of a block are one word. If extract is false processed images are
+// found too and flags are left intact.
+void scan_range(const PHash& base,
+    HashStore& store,
+    size_t begin,
+    size_t end,
+    int threshold,
+    std::vector<size_t>& found,
+    bool extract = true);
+
+// Parallel scan_range() over the whole range using persistent threads.
+class LinearScanner : public ClusterIndex
+{
+public:
+    LinearScanner(HashStore& store, int threads_num);
+
+    // Positions are appended to found in ascending order, whatever number of
+    // threads is used.
+    void scan(const PHash& base,
+        size_t begin,
+        size_t end,
+        int threshold,
+        std::vector<size_t>& found,
+        bool extract = true);
+
+    void extract(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) override
+    {
+        if (from < store.size()) {
+            scan(base, from, store.size(), threshold, found);
+        }
+    }
+
+    void query(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) override
+    {
+        if (from < store.size()) {
+            scan(base, from, store.size(), threshold, found, false);
+        }
+    }
+
+private:
+    // images per chunk of work, 16 KiB of hashes
+    static const size_t CHUNK_SIZE = 1024;
+
+    HashStore& store;
+    ScanScheduler scheduler;
+    std::vector<std::vector<size_t>> found_by_worker;
+};
+
+} // namespace imgdupl
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+
+#include <cxxopts.hpp>
+
+#include "tokenizer.hpp"
+#include "exc.hpp"
+#include "union_find.hpp"
+#include "cluster_writer.hpp"
+
+using namespace imgdupl;
+
+// Unites clusters from results of clusterizer --shard: images which are in one
+// cluster of any of the files end up in one cluster. Clusters are numbered in
+// order of their smallest image ids, images of a cluster are printed in
+// ascending order, so the smallest id is the base one.
+class ClustersMerger
+{
+public:
+    void add_file(const std::string& name)
+    {
+        std::ifstream data(name.c_str(), std::ios::in);
+        THROW_EXC_IF_FAILED(!data.fail(), "Couldn't open file \"%s\"", name.c_str());
+
+        // first image met of every cluster of the file
+        std::unordered_map<uint64_t, uint32_t> cluster_images;
+
+        std::string line;
+        Tokens tokens;
+
+        while (std::getline(data, line)) {
+            tokenize(line, tokens, "\t");
+            THROW_EXC_IF_FAILED(tokens.size() == 2, "malformed line \"%s\" in \"%s\"", line.c_str(), name.c_str());
+
+            uint32_t image = image_index(std::stoul(tokens[0]));
+            auto it = cluster_images.emplace(std::stoull(tokens[1]), image).first;
+
+            components.unite(it->second, image);
+        }
+    }
+
+    void write(ClusterWriter& writer)
+    {
+        // (smallest image id of the component, image id)
+        std::vector<std::pair<uint32_t, uint32_t>> members;
+        std::vector<uint32_t> smallest(image_ids.size(), UINT32_MAX);
+
+        for (size_t i = 0; i < image_ids.size(); i++) {
+            uint32_t root = components.find(i);
+            smallest[root] = std::min(smallest[root], image_ids[i]);
+        }
+
+        members.reserve(image_ids.size());
+
+        for (size_t i = 0; i < image_ids.size(); i++) {
+            members.push_back(std::make_pair(smallest[components.find(i)], image_ids[i]));
+        }
+
+        std::sort(members.begin(), members.end());
+
+        uint64_t cluster_id = 0;
+
+        for (size_t i = 0; i < members.size(); i++) {
+            if (i == 0 || members[i].first != members[i - 1].first) {
+                cluster_id++;
+            }
+
+            writer.write(members[i].second, cluster_id);
+        }
+
+        std::cerr << image_ids.size() << " images in " << cluster_id << " clusters" << std::endl;
+    }
+
+private:
+    std::unordered_map<uint32_t, uint32_t> indexes;
+    std::vector<uint32_t> image_ids;
+    UnionFind components;
+
+    uint32_t image_index(uint32_t image_id)
+    {
+        auto it = indexes.emplace(image_id, image_ids.size());
+
+        if (it.second) {
+            image_ids.push_back(image_id);
+            components.resize(image_ids.size());
+        }
+
+        return it.first->second;
+    }
+};
+
+int
+main(int argc, char** argv)
+{
+    try {
+        cxxopts::Options args(argv[0], "merge results of sharded clusterization");
+
+        // clang-format off
+        args.add_options()
+            ("h,help", "show this help and exit")
+            ("files", "results of clusterizer --shard", cxxopts::value<std::vector<std::string>>())
+            ;
+        // clang-format on
+
+        args.parse_positional({"files"});
+        args.positional_help("<file> [<file> ...]");
+
+        auto opts = args.parse(argc, argv);
+
+        if (opts.count("help") || opts.count("files") == 0) {
+            std::cout << args.help() << std::endl;
+            std::cout << "Example: " << argv[0] << " clusters_32.0 clusters_32.1 clusters_32.2" << std::endl << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        ClustersMerger merger;
+
+        for (auto& name : opts["files"].as<std::vector<std::string>>()) {
+            merger.add_file(name);
+        }
+
+        ClusterWriter writer(stdout);
+
+        merger.write(writer);
+        writer.flush();
+    } catch (std::exception& exc) {
+        std::cerr << "Error: " << exc.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
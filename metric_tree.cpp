@@ -0,0 +1,293 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <utility>
+
+#include "metric_tree.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+static const uint32_t NONE = UINT32_MAX;
+
+BKTree::BKTree(HashStore& store_)
+    : store(store_)
+{
+    THROW_EXC_IF_FAILED(store.size() < NONE, "too many images for a BK-tree: %zu", store.size());
+
+    nodes.resize(store.size());
+
+    for (size_t i = 0; i < store.size(); i++) {
+        insert(i);
+    }
+
+    // a parent is always inserted before its children
+    for (size_t i = nodes.size(); i-- > 1;) {
+        nodes[nodes[i].parent].alive += nodes[i].alive;
+    }
+}
+
+void
+BKTree::insert(uint32_t pos)
+{
+    Node& node = nodes[pos];
+
+    node.parent = NONE;
+    node.first_child = NONE;
+    node.next_sibling = NONE;
+    node.alive = 1;
+    node.distance = 0;
+    node.removed = false;
+
+    if (pos == 0) {
+        return;
+    }
+
+    uint32_t cur = 0;
+
+    for (;;) {
+        int d = hamming_distance(store.hash(cur), store.hash(pos));
+
+        uint32_t child = nodes[cur].first_child;
+        while (child != NONE && nodes[child].distance != d) {
+            child = nodes[child].next_sibling;
+        }
+
+        if (child == NONE) {
+            node.parent = cur;
+            node.distance = d;
+            node.next_sibling = nodes[cur].first_child;
+            nodes[cur].first_child = pos;
+            break;
+        }
+
+        cur = child;
+    }
+}
+
+void
+BKTree::remove(uint32_t node)
+{
+    nodes[node].removed = true;
+
+    for (uint32_t n = node; n != NONE; n = nodes[n].parent) {
+        nodes[n].alive--;
+    }
+}
+
+// Calls visit(node, distance) for every node which may be within threshold
+// of the base.
+template <typename Visitor>
+void
+BKTree::search(const PHash& base, int threshold, bool skip_removed, Visitor visit)
+{
+    if (nodes.empty()) {
+        return;
+    }
+
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty()) {
+        uint32_t cur = stack.back();
+        stack.pop_back();
+
+        if (skip_removed && nodes[cur].alive == 0) {
+            continue;
+        }
+
+        int d = hamming_distance(base, store.hash(cur));
+
+        visit(cur, d);
+
+        for (uint32_t child = nodes[cur].first_child; child != NONE; child = nodes[child].next_sibling) {
+            if (abs(nodes[child].distance - d) <= threshold) {
+                stack.push_back(child);
+            }
+        }
+    }
+}
+
+void
+BKTree::extract(const PHash& base, size_t from, int threshold, std::vector<size_t>& found)
+{
+    size_t first = found.size();
+
+    search(base, threshold, true, [&](uint32_t node, int d) {
+        if (nodes[node].removed) {
+            return;
+        }
+
+        if (store.processed(node)) {
+            remove(node);
+        } else if (d <= threshold && node >= from) {
+            store.mark_processed(node);
+            remove(node);
+            found.push_back(node);
+        }
+    });
+
+    std::sort(found.begin() + first, found.end());
+}
+
+void
+BKTree::query(const PHash& base, size_t from, int threshold, std::vector<size_t>& found)
+{
+    size_t first = found.size();
+
+    search(base, threshold, false, [&](uint32_t node, int d) {
+        if (d <= threshold && node >= from) {
+            found.push_back(node);
+        }
+    });
+
+    std::sort(found.begin() + first, found.end());
+}
+
+VPTree::VPTree(HashStore& store_)
+    : store(store_)
+{
+    THROW_EXC_IF_FAILED(store.size() < NONE, "too many images for a VP-tree: %zu", store.size());
+
+    std::vector<std::pair<int, uint32_t>> items(store.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        items[i] = std::make_pair(0, i);
+    }
+
+    nodes.reserve(store.size());
+    build(items, 0, items.size(), NONE);
+
+    // nodes are created in preorder, a parent goes before its children
+    for (size_t i = nodes.size(); i-- > 1;) {
+        nodes[nodes[i].parent].alive += nodes[i].alive;
+    }
+}
+
+uint32_t
+VPTree::build(std::vector<std::pair<int, uint32_t>>& items, size_t begin, size_t end, uint32_t parent)
+{
+    if (begin == end) {
+        return NONE;
+    }
+
+    // a vantage point is picked pseudo randomly, but deterministically
+    std::minstd_rand rng(begin ^ (end << 16));
+    std::swap(items[begin], items[begin + rng() % (end - begin)]);
+
+    uint32_t node = nodes.size();
+    uint32_t vp = items[begin].second;
+
+    nodes.push_back(Node {vp, parent, NONE, NONE, 1, 0, false});
+
+    begin++;
+    if (begin == end) {
+        return node;
+    }
+
+    for (size_t i = begin; i < end; i++) {
+        items[i].first = hamming_distance(store.hash(vp), store.hash(items[i].second));
+    }
+
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end);
+
+    // images at distance mu may end up on both sides
+    nodes[node].mu = items[middle].first;
+
+    uint32_t inner = build(items, begin, middle, node);
+    uint32_t outer = build(items, middle, end, node);
+
+    nodes[node].inner = inner;
+    nodes[node].outer = outer;
+
+    return node;
+}
+
+void
+VPTree::remove(uint32_t node)
+{
+    nodes[node].removed = true;
+
+    for (uint32_t n = node; n != NONE; n = nodes[n].parent) {
+        nodes[n].alive--;
+    }
+}
+
+template <typename Visitor>
+void
+VPTree::search(const PHash& base, int threshold, bool skip_removed, Visitor visit)
+{
+    if (nodes.empty()) {
+        return;
+    }
+
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty()) {
+        uint32_t cur = stack.back();
+        stack.pop_back();
+
+        const Node& node = nodes[cur];
+
+        if (skip_removed && node.alive == 0) {
+            continue;
+        }
+
+        int d = hamming_distance(base, store.hash(node.pos));
+
+        visit(cur, d);
+
+        if (node.inner != NONE && d - threshold <= node.mu) {
+            stack.push_back(node.inner);
+        }
+
+        if (node.outer != NONE && d + threshold >= node.mu) {
+            stack.push_back(node.outer);
+        }
+    }
+}
+
+void
+VPTree::extract(const PHash& base, size_t from, int threshold, std::vector<size_t>& found)
+{
+    size_t first = found.size();
+
+    search(base, threshold, true, [&](uint32_t node, int d) {
+        if (nodes[node].removed) {
+            return;
+        }
+
+        uint32_t pos = nodes[node].pos;
+
+        if (store.processed(pos)) {
+            remove(node);
+        } else if (d <= threshold && pos >= from) {
+            store.mark_processed(pos);
+            remove(node);
+            found.push_back(pos);
+        }
+    });
+
+    std::sort(found.begin() + first, found.end());
+}
+
+void
+VPTree::query(const PHash& base, size_t from, int threshold, std::vector<size_t>& found)
+{
+    size_t first = found.size();
+
+    search(base, threshold, false, [&](uint32_t node, int d) {
+        uint32_t pos = nodes[node].pos;
+
+        if (d <= threshold && pos >= from) {
+            found.push_back(pos);
+        }
+    });
+
+    std::sort(found.begin() + first, found.end());
+}
+
+} // namespace imgdupl
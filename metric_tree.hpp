@@ -0,0 +1,100 @@
+#ifndef __METRIC_TREE_HPP_INCLUDED__
+#define __METRIC_TREE_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include "phash.hpp"
+#include "hash_store.hpp"
+#include "cluster_index.hpp"
+
+namespace imgdupl
+{
+
+// Metric trees over Hamming distance between hashes from a HashStore. Images
+// are never taken out of a tree, they are tombstoned instead: every node
+// knows how many live images are in its subtree and subtrees without them
+// aren't visited. Images processed behind a tree's back (e.g. cluster bases)
+// are tombstoned the first time a search comes across them.
+//
+// With 128 bit hashes distances between unrelated images are close to 64,
+// so trees prune well only with small thresholds.
+
+// Burkhard-Keller tree: children of a node are keyed by their distance to it,
+// only children with keys in [d - t, d + t] range may contain images within t
+// of a query which is d away from the node.
+class BKTree : public ClusterIndex
+{
+public:
+    BKTree(HashStore& store);
+
+    void extract(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) override;
+    void query(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) override;
+
+    BKTree(BKTree const&) = delete;
+    BKTree& operator=(BKTree const&) = delete;
+
+private:
+    // images are inserted in order of positions, so a node's index is the
+    // position of its image in the store
+    struct Node {
+        uint32_t parent;
+        uint32_t first_child;
+        uint32_t next_sibling;
+        uint32_t alive;
+        uint8_t distance; // to the parent
+        bool removed;
+    };
+
+    HashStore& store;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> stack;
+
+    void insert(uint32_t pos);
+    void remove(uint32_t node);
+
+    template <typename Visitor>
+    void search(const PHash& base, int threshold, bool skip_removed, Visitor visit);
+};
+
+// Vantage point tree: images closer to a node's vantage point than the median
+// distance mu go to the inner subtree, others go to the outer one.
+class VPTree : public ClusterIndex
+{
+public:
+    VPTree(HashStore& store);
+
+    void extract(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) override;
+    void query(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) override;
+
+    VPTree(VPTree const&) = delete;
+    VPTree& operator=(VPTree const&) = delete;
+
+private:
+    struct Node {
+        uint32_t pos; // vantage point
+        uint32_t parent;
+        uint32_t inner;
+        uint32_t outer;
+        uint32_t alive;
+        uint8_t mu;
+        bool removed;
+    };
+
+    HashStore& store;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> stack;
+
+    uint32_t build(std::vector<std::pair<int, uint32_t>>& items, size_t begin, size_t end, uint32_t parent);
+    void remove(uint32_t node);
+
+    template <typename Visitor>
+    void search(const PHash& base, int threshold, bool skip_removed, Visitor visit);
+};
+
+} // namespace imgdupl
+
+#endif
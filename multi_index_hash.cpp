@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <utility>
+#include <tuple>
+
+#include "multi_index_hash.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+static const int MIN_SUBSTRING_BITS = 8;
+static const int MAX_SUBSTRING_BITS = 32;
+static const int MAX_PREFIX_BITS = 16;
+
+int
+MultiIndexHash::default_substrings(size_t images_count, int hash_bits)
+{
+    int bits = MIN_SUBSTRING_BITS;
+
+    while (bits < MAX_SUBSTRING_BITS && (size_t(1) << bits) < images_count) {
+        bits++;
+    }
+
+    return (hash_bits + bits - 1) / bits;
+}
+
+MultiIndexHash::MultiIndexHash(HashStore& store_, int substrings_, int bits)
+    : store(store_)
+    , checked(store_.size(), 0)
+    , query_num(0)
+{
+    THROW_EXC_IF_FAILED(bits > 0 && bits <= PHASH_BITS, "hashes can't have %d bits", bits);
+
+    int m = substrings_ > 0 ? substrings_ : default_substrings(store.size(), bits);
+
+    THROW_EXC_IF_FAILED(m * MAX_SUBSTRING_BITS >= bits && m <= bits,
+        "number of substrings must be between %d and %d", (bits + MAX_SUBSTRING_BITS - 1) / MAX_SUBSTRING_BITS, bits);
+
+    tables.resize(m);
+
+    for (int i = 0, start = 0; i < m; i++) {
+        tables[i].start = start;
+        tables[i].length = bits / m + (i < bits % m ? 1 : 0);
+        start += tables[i].length;
+
+        build_table(tables[i]);
+    }
+}
+
+void
+MultiIndexHash::build_table(Table& table)
+{
+    size_t count = store.size();
+
+    table.prefix_bits = std::min(table.length, MAX_PREFIX_BITS);
+    int prefix_shift = table.length - table.prefix_bits;
+
+    table.offsets.assign((size_t(1) << table.prefix_bits) + 1, 0);
+    table.keys.resize(count);
+    table.positions.resize(count);
+
+    std::vector<uint32_t> keys(count);
+
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = hash_substring(store.hash(i), table.start, table.length);
+        table.offsets[(keys[i] >> prefix_shift) + 1]++;
+    }
+
+    for (size_t i = 1; i < table.offsets.size(); i++) {
+        table.offsets[i] += table.offsets[i - 1];
+    }
+
+    // counting sort by prefix keeps positions ascending within a prefix
+    std::vector<uint32_t> next(table.offsets.begin(), table.offsets.end() - 1);
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t j = next[keys[i] >> prefix_shift]++;
+        table.keys[j] = keys[i];
+        table.positions[j] = i;
+    }
+
+    if (prefix_shift == 0) {
+        return;
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> bucket;
+
+    for (size_t p = 0; p + 1 < table.offsets.size(); p++) {
+        uint32_t lo = table.offsets[p];
+        uint32_t hi = table.offsets[p + 1];
+
+        if (hi - lo < 2) {
+            continue;
+        }
+
+        bucket.clear();
+        for (uint32_t j = lo; j < hi; j++) {
+            bucket.push_back(std::make_pair(table.keys[j], table.positions[j]));
+        }
+
+        std::sort(bucket.begin(), bucket.end());
+
+        for (uint32_t j = lo; j < hi; j++) {
+            table.keys[j] = bucket[j - lo].first;
+            table.positions[j] = bucket[j - lo].second;
+        }
+    }
+}
+
+// Calls visit(position) for every image from positions starting with from
+// which has at least one substring within threshold / m bits of the base's
+// substring. Every image is visited once.
+template <typename Visitor>
+void
+MultiIndexHash::probe(const PHash& base, size_t from, int threshold, Visitor visit)
+{
+    if (++query_num == 0) {
+        std::fill(checked.begin(), checked.end(), 0);
+        query_num = 1;
+    }
+
+    int radius = threshold / static_cast<int>(tables.size());
+
+    for (auto& table : tables) {
+        uint32_t key = hash_substring(base, table.start, table.length);
+        int prefix_shift = table.length - table.prefix_bits;
+
+        auto lookup = [&](uint32_t k) {
+            uint32_t prefix = k >> prefix_shift;
+
+            auto keys_begin = table.keys.begin() + table.offsets[prefix];
+            auto keys_end = table.keys.begin() + table.offsets[prefix + 1];
+
+            if (prefix_shift != 0) {
+                std::tie(keys_begin, keys_end) = std::equal_range(keys_begin, keys_end, k);
+            }
+
+            auto pos_begin = table.positions.begin() + (keys_begin - table.keys.begin());
+            auto pos_end = table.positions.begin() + (keys_end - table.keys.begin());
+
+            // positions of equal keys are ascending
+            for (auto it = std::lower_bound(pos_begin, pos_end, from); it != pos_end; ++it) {
+                if (checked[*it] != query_num) {
+                    checked[*it] = query_num;
+                    visit(*it);
+                }
+            }
+        };
+
+        lookup(key);
+
+        // all values which differ from the key in exactly k bits, masks with
+        // k bits set are enumerated with Gosper's hack
+        for (int k = 1; k <= std::min(radius, table.length); k++) {
+            uint64_t limit = uint64_t(1) << table.length;
+
+            for (uint64_t mask = (uint64_t(1) << k) - 1; mask < limit;) {
+                lookup(key ^ static_cast<uint32_t>(mask));
+
+                uint64_t c = mask & -mask;
+                uint64_t r = mask + c;
+                mask = (((r ^ mask) >> 2) / c) | r;
+            }
+        }
+    }
+}
+
+void
+MultiIndexHash::extract(const PHash& base, size_t from, int threshold, std::vector<size_t>& found)
+{
+    size_t first = found.size();
+
+    probe(base, from, threshold, [&](size_t pos) {
+        if (!store.processed(pos) && hamming_distance(base, store.hash(pos)) <= threshold) {
+            store.mark_processed(pos);
+            found.push_back(pos);
+        }
+    });
+
+    std::sort(found.begin() + first, found.end());
+}
+
+void
+MultiIndexHash::query(const PHash& base, size_t from, int threshold, std::vector<size_t>& found)
+{
+    size_t first = found.size();
+
+    probe(base, from, threshold, [&](size_t pos) {
+        if (hamming_distance(base, store.hash(pos)) <= threshold) {
+            found.push_back(pos);
+        }
+    });
+
+    std::sort(found.begin() + first, found.end());
+}
+
+} // namespace imgdupl
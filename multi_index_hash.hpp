@@ -0,0 +1,94 @@
+#ifndef __MULTI_INDEX_HASH_HPP_INCLUDED__
+#define __MULTI_INDEX_HASH_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "phash.hpp"
+#include "hash_store.hpp"
+#include "cluster_index.hpp"
+
+namespace imgdupl
+{
+
+// Multi-index hashing (Norouzi, Punjani, Fleet). A hash is cut into m disjoint
+// substrings and there is a table of images per substring. If two hashes
+// differ in at most t bits, then by pigeonhole principle at least one of their
+// substrings differs in at most t / m bits. So it's enough to look up every
+// substring of a query and its neighbours within t / m bits in the tables and
+// check distances of candidates found there only. Search results are exact.
+//
+// Lookups are cheap while t / m is small, with large thresholds number of
+// neighbours to probe grows quickly and the linear scan becomes faster.
+//
+// Substrings cover only the significant bits of hashes: zero padding of
+// narrower hashes would make substrings which are equal for all images.
+class MultiIndexHash : public ClusterIndex
+{
+public:
+    // substrings == 0 means choosing their number by the size of the store,
+    // bits are significant bits of hashes, see HashAlgorithm
+    MultiIndexHash(HashStore& store, int substrings = 0, int bits = PHASH_BITS);
+
+    void extract(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) override;
+
+    void query(const PHash& base, size_t from, int threshold, std::vector<size_t>& found) override;
+
+    int substrings() const
+    {
+        return static_cast<int>(tables.size());
+    }
+
+    // Substrings about log2(n) bits long keep buckets a few images large.
+    static int default_substrings(size_t images_count, int hash_bits = PHASH_BITS);
+
+    MultiIndexHash(MultiIndexHash const&) = delete;
+    MultiIndexHash& operator=(MultiIndexHash const&) = delete;
+
+private:
+    // Images sorted by a substring value. Values with the same prefix_bits
+    // leading bits occupy a contiguous range given by offsets, a value is
+    // searched for in the range with binary search.
+    struct Table {
+        int start;
+        int length;
+        int prefix_bits;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> keys;
+        std::vector<uint32_t> positions;
+    };
+
+    HashStore& store;
+    std::vector<Table> tables;
+
+    // query number an image was checked last time at, so an image found in
+    // several tables is checked only once
+    std::vector<uint32_t> checked;
+    uint32_t query_num;
+
+    void build_table(Table& table);
+
+    template <typename Visitor>
+    void probe(const PHash& base, size_t from, int threshold, Visitor visit);
+};
+
+// Value of length bits of the hash starting from the bit start.
+inline uint32_t
+hash_substring(const PHash& hash, int start, int length)
+{
+    int word = start / 64;
+    int shift = start % 64;
+
+    uint64_t v = hash[word] >> shift;
+    if (shift + length > 64) {
+        v |= hash[word + 1] << (64 - shift);
+    }
+
+    return static_cast<uint32_t>(v & ((uint64_t(1) << length) - 1));
+}
+
+} // namespace imgdupl
+
+#endif
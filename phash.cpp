@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "phash.hpp"
+#include "hash_delimeter.hpp"
+#include "tokenizer.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+const HashAlgorithm DEFAULT_HASH_ALGORITHM = {"dct50-128", 128};
+
+void
+check_hash_algorithm(const std::string& data, const HashAlgorithm& algo, const std::string& expected)
+{
+    THROW_EXC_IF_FAILED(algo.name == expected, "\"%s\" holds %s hashes (%d bits), not %s ones", data.c_str(),
+        algo.name.c_str(), algo.bits, expected.c_str());
+}
+
+PHash
+make_hash(const std::string& data)
+{
+    PHash hash;
+    size_t words = 0;
+
+    Separator separator(HASH_PRINT_DELIMETER);
+    Tokenizer tokenizer(data, separator);
+
+    for (auto& v : tokenizer) {
+        THROW_EXC_IF_FAILED(words < hash.size(), "hash \"%s\" is longer than %d bits", data.c_str(), PHASH_BITS);
+        hash[words++] = std::stoull(v);
+    }
+
+    THROW_EXC_IF_FAILED(words == hash.size(), "hash \"%s\" is shorter than %d bits", data.c_str(), PHASH_BITS);
+
+    return hash;
+}
+
+void
+encode_hash_blob(const PHash& hash, uint8_t* blob)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(blob, hash.data(), PHASH_BLOB_SIZE);
+#else
+    for (size_t i = 0; i < PHASH_BLOB_SIZE; i++) {
+        blob[i] = static_cast<uint8_t>(hash[i / 8] >> (i % 8 * 8));
+    }
+#endif
+}
+
+PHash
+decode_hash_blob(const void* blob, size_t size)
+{
+    THROW_EXC_IF_FAILED(size == PHASH_BLOB_SIZE, "hash BLOB is %zu bytes long, expected %zu bytes", size, PHASH_BLOB_SIZE);
+
+    PHash hash;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(hash.data(), blob, PHASH_BLOB_SIZE);
+#else
+    const uint8_t* bytes = static_cast<const uint8_t*>(blob);
+
+    hash.fill(0);
+    for (size_t i = 0; i < PHASH_BLOB_SIZE; i++) {
+        hash[i / 8] |= uint64_t(bytes[i]) << (i % 8 * 8);
+    }
+#endif
+
+    return hash;
+}
+
+} // namespace
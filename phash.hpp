@@ -1,13 +1,96 @@
 #ifndef __PHASH_HPP_INCLUDED__
 #define __PHASH_HPP_INCLUDED__
 
-#include <vector>
+#include <array>
+#include <string>
+#include <stddef.h>
 #include <stdint.h>
 
 namespace imgdupl
 {
 
-typedef std::vector<uint64_t> PHash;
+// Perceptual hash of Bits bits packed into 64 bit words, the first bit is the
+// least significant bit of the first word.
+template <int Bits>
+using BasicPHash = std::array<uint64_t, (Bits + 63) / 64>;
+
+// width of hashes calculated by imghash and processed by other utilities
+const int PHASH_BITS = 128;
+
+typedef BasicPHash<PHASH_BITS> PHash;
+
+// Algorithm hashes were calculated with, named as in the hasher registry of
+// imghash. Hashes narrower than PHASH_BITS keep bits significant bits in the
+// lowest ones, the rest are zero.
+struct HashAlgorithm {
+    std::string name;
+    int bits;
+
+    bool operator==(const HashAlgorithm& other) const
+    {
+        return name == other.name && bits == other.bits;
+    }
+};
+
+// the only algorithm of versions which didn't record it
+extern const HashAlgorithm DEFAULT_HASH_ALGORITHM;
+
+// Throws unless hashes of data (a database or an index file) were made with
+// the expected algorithm, hashes of different ones can't be compared.
+void check_hash_algorithm(const std::string& data, const HashAlgorithm& algo, const std::string& expected);
+
+// Parses a hash printed as a list of words separated by HASH_PRINT_DELIMETER,
+// throws if the number of words doesn't match PHash.
+PHash make_hash(const std::string& data);
+
+// size of a hash stored as a BLOB in a database
+const size_t PHASH_BLOB_SIZE = PHASH_BITS / 8;
+
+// Binary form of a hash for databases: words one after another, each of them
+// little endian, PHASH_BLOB_SIZE bytes in total.
+void encode_hash_blob(const PHash& hash, uint8_t* blob);
+
+// Reverse of encode_hash_blob(), throws if the size doesn't match PHash.
+PHash decode_hash_blob(const void* blob, size_t size);
+
+template <size_t Words>
+inline int
+hamming_distance(const std::array<uint64_t, Words>& h1, const std::array<uint64_t, Words>& h2)
+{
+    int dist = 0;
+
+    for (size_t i = 0; i < Words; i++) {
+        dist += __builtin_popcountll(h1[i] ^ h2[i]);
+    }
+
+    return dist;
+}
+
+// Whether the distance between hashes is not greater than threshold. Words
+// are compared one at a time: the distance of the words seen so far is a lower
+// bound of the whole one, so a pair is rejected as soon as it exceeds the
+// threshold and the rest of the words aren't compared.
+template <size_t Words>
+inline bool
+within_distance(const std::array<uint64_t, Words>& h1, const std::array<uint64_t, Words>& h2, int threshold)
+{
+    int dist = 0;
+
+    for (size_t i = 0; i < Words; i++) {
+        dist += __builtin_popcountll(h1[i] ^ h2[i]);
+        if (dist > threshold) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The largest threshold within_distance() pays off with on unrelated hashes.
+// Their words differ in 32 bits give or take 4, with larger thresholds the
+// first word rejects pairs too randomly for the branch to be predicted and
+// mispredictions cost more than the popcounts saved.
+const int EARLY_REJECT_MAX_THRESHOLD = 24;
 
 } // namespace
 
@@ -1,7 +1,10 @@
 #include <cstdlib>
 #include <cstring>
+#include <cstdio>
 #include <string>
 #include <fstream>
+#include <memory>
+#include <vector>
 
 #include <sqlite3.h>
 
@@ -14,41 +17,88 @@
 #include "hash_delimeter.hpp"
 #include "tokenizer.hpp"
 #include "exc.hpp"
+#include "hashes_db.hpp"
+#include "clusters_db.hpp"
 
 using namespace imgdupl;
 
-// key is a cluster id, value is an array of images' filenames
-using Cluster = std::map<std::string, std::vector<std::string>>;
-
-// all clusters as an array of maps
-using Clusters = std::vector<Cluster>;
+// Writes clusters as they are read from the database, so memory use doesn't
+// depend on the number of clusters.
+class ClustersPrinter
+{
+public:
+    virtual ~ClustersPrinter() {}
+
+    virtual void print(const std::string& cluster_id, const std::vector<std::string>& paths) = 0;
+    virtual void finish() = 0;
+
+protected:
+    // key is a cluster id, value is an array of images' filenames
+    static nlohmann::json make_cluster(const std::string& cluster_id, const std::vector<std::string>& paths)
+    {
+        nlohmann::json cluster = nlohmann::json::object();
+        cluster[cluster_id] = paths;
+        return cluster;
+    }
+};
 
-void
-print(const cxxopts::ParseResult& opts)
+// Array of clusters, the same output as dumping the whole array with an
+// indent of 4.
+class JsonPrinter : public ClustersPrinter
 {
-    int min_cluster_size = 1;
-    if (opts.count("min-size") > 0) {
-        min_cluster_size = opts["min-size"].as<int>();
+public:
+    void print(const std::string& cluster_id, const std::vector<std::string>& paths) override
+    {
+        std::string cluster = make_cluster(cluster_id, paths).dump(4);
+
+        // elements of the array are indented one level deeper
+        buffer.assign(first ? "[\n    " : ",\n    ");
+        for (char c : cluster) {
+            buffer.push_back(c);
+            if (c == '\n') {
+                buffer.append("    ");
+            }
+        }
+
+        fwrite(buffer.data(), 1, buffer.size(), stdout);
+
+        first = false;
     }
 
-    std::string database = opts["database"].as<std::string>();
-    std::string table = opts["table"].as<std::string>();
+    void finish() override
+    {
+        fmt::print("{}\n", first ? "[]" : "\n]");
+    }
 
-    sqlite3* db = NULL;
-    int rc;
+private:
+    bool first = true;
+    std::string buffer;
+};
 
-    sqlite3_initialize();
+// One cluster per line.
+class NdjsonPrinter : public ClustersPrinter
+{
+public:
+    void print(const std::string& cluster_id, const std::vector<std::string>& paths) override
+    {
+        fmt::print("{}\n", make_cluster(cluster_id, paths).dump());
+    }
 
-    rc = sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY, NULL);
-    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+    void finish() override {}
+};
 
+// Clusters exported by older versions of export2db have no members table,
+// their images are looked up one by one.
+void
+print_clusters_by_images(sqlite3* db, const std::string& table, int min_cluster_size, ClustersPrinter& printer)
+{
     char iterate_over_clusters_st[512];
     sqlite3_stmt* iterate_over_clusters_stmt = NULL;
 
     snprintf(iterate_over_clusters_st, sizeof(iterate_over_clusters_st), "SELECT cluster_id,images FROM %s WHERE count >= %d",
         table.c_str(), min_cluster_size);
 
-    rc = sqlite3_prepare_v2(db, iterate_over_clusters_st, strlen(iterate_over_clusters_st), &iterate_over_clusters_stmt, NULL);
+    int rc = sqlite3_prepare_v2(db, iterate_over_clusters_st, strlen(iterate_over_clusters_st), &iterate_over_clusters_stmt, NULL);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
 
     char select_path_st[512];
@@ -58,8 +108,6 @@ print(const cxxopts::ParseResult& opts)
     rc = sqlite3_prepare_v2(db, select_path_st, strlen(select_path_st), &select_path_stmt, NULL);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
 
-    Clusters clusters;
-
     for (;;) {
         rc = sqlite3_step(iterate_over_clusters_stmt);
         THROW_EXC_IF_FAILED(rc == SQLITE_ROW || rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
@@ -71,9 +119,7 @@ print(const cxxopts::ParseResult& opts)
         std::string images = std::string(reinterpret_cast<const char*>(sqlite3_column_text(iterate_over_clusters_stmt, 1)),
             sqlite3_column_bytes(iterate_over_clusters_stmt, 1));
 
-        Cluster cluster;
-
-        std::string path;
+        std::vector<std::string> paths;
         Tokens images_id;
 
         tokenize(images, images_id, ",");
@@ -87,25 +133,111 @@ print(const cxxopts::ParseResult& opts)
             rc = sqlite3_step(select_path_stmt);
             THROW_EXC_IF_FAILED(rc == SQLITE_ROW, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
 
-            path = std::string(
+            paths.emplace_back(
                 reinterpret_cast<const char*>(sqlite3_column_text(select_path_stmt, 0)), sqlite3_column_bytes(select_path_stmt, 0));
-            cluster[std::to_string(cluster_id)].push_back(path);
 
             rc = sqlite3_reset(select_path_stmt);
             THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_reset() failed: \"%s\"", sqlite3_errmsg(db));
         }
 
-        clusters.push_back(cluster);
+        printer.print(std::to_string(cluster_id), paths);
     }
 
-    nlohmann::json js = clusters;
-    fmt::print("{}\n", js.dump(4));
-
     rc = sqlite3_finalize(select_path_stmt);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
 
     rc = sqlite3_finalize(iterate_over_clusters_stmt);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+// Reads paths of all clusters' images with a single join over the members
+// table, rows come ordered by clusters and then by members.
+void
+print_clusters_by_members(sqlite3* db, const std::string& table, int min_cluster_size, ClustersPrinter& printer)
+{
+    std::string members_table = members_table_name(table);
+
+    // CROSS JOIN keeps the clusters table as the outer loop, so rows come out
+    // in its order without sorting
+    std::string st = "SELECT c.cluster_id, h.path FROM " + table + " AS c CROSS JOIN " + members_table
+        + " AS m ON m.cluster_id = c.cluster_id CROSS JOIN hashes AS h ON h.id = m.image_id WHERE c.count >= ? "
+          "ORDER BY c.rowid, m.rowid";
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_prepare_v2(db, st.c_str(), st.size(), &stmt, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_prepare_v2() failed: \"%s\"", sqlite3_errmsg(db));
+
+    rc = sqlite3_bind_int(stmt, 1, min_cluster_size);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_bind_int() failed: \"%s\"", sqlite3_errmsg(db));
+
+    // images of the cluster being read, it's printed when rows of the next
+    // one begin
+    std::vector<std::string> paths;
+    int64_t prev_cluster_id = -1;
+
+    for (;;) {
+        rc = sqlite3_step(stmt);
+        THROW_EXC_IF_FAILED(rc == SQLITE_ROW || rc == SQLITE_DONE, "sqlite3_step() failed: \"%s\"", sqlite3_errmsg(db));
+        if (rc == SQLITE_DONE) {
+            break;
+        }
+
+        int64_t cluster_id = sqlite3_column_int64(stmt, 0);
+
+        if (cluster_id != prev_cluster_id && !paths.empty()) {
+            printer.print(std::to_string(prev_cluster_id), paths);
+            paths.clear();
+        }
+        prev_cluster_id = cluster_id;
+
+        paths.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)), sqlite3_column_bytes(stmt, 1));
+    }
+
+    if (!paths.empty()) {
+        printer.print(std::to_string(prev_cluster_id), paths);
+    }
+
+    rc = sqlite3_finalize(stmt);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_finalize() failed: \"%s\"", sqlite3_errmsg(db));
+}
+
+void
+print(const cxxopts::ParseResult& opts)
+{
+    int min_cluster_size = 1;
+    if (opts.count("min-size") > 0) {
+        min_cluster_size = opts["min-size"].as<int>();
+    }
+
+    std::string database = opts["database"].as<std::string>();
+    std::string table = opts["table"].as<std::string>();
+    std::string format = opts["format"].as<std::string>();
+
+    sqlite3* db = NULL;
+    int rc;
+
+    sqlite3_initialize();
+
+    rc = sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY, NULL);
+    THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_open_v2() failed");
+
+    std::unique_ptr<ClustersPrinter> printer;
+
+    if (format == "json") {
+        printer.reset(new JsonPrinter());
+    } else if (format == "ndjson") {
+        printer.reset(new NdjsonPrinter());
+    } else {
+        THROW_EXC("unknown output format \"%s\", must be one of 'json' or 'ndjson'", format.c_str());
+    }
+
+    if (table_exists(db, members_table_name(table))) {
+        print_clusters_by_members(db, table, min_cluster_size, *printer);
+    } else {
+        print_clusters_by_images(db, table, min_cluster_size, *printer);
+    }
+
+    printer->finish();
 
     rc = sqlite3_close(db);
     THROW_EXC_IF_FAILED(rc == SQLITE_OK, "sqlite3_close() failed: %i", rc);
@@ -125,6 +257,8 @@ main(int argc, char** argv)
             ("d,database", "SQLite database file", cxxopts::value<std::string>())
             ("t,table", "name of a table with clusters in database", cxxopts::value<std::string>())
             ("s,min-size", "minimal cluster size", cxxopts::value<int>())
+            ("f,format", "output format: 'json' for an array of clusters or 'ndjson' for a cluster per line",
+                cxxopts::value<std::string>()->default_value("json"))
             ;
         // clang-format on
 
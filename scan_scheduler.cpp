@@ -0,0 +1,179 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+
+#include "scan_scheduler.hpp"
+
+namespace imgdupl
+{
+
+static const int CHUNK_INDEX_BITS = 24;
+static const uint64_t CHUNK_INDEX_MASK = (uint64_t(1) << CHUNK_INDEX_BITS) - 1;
+static const int RUN_SHIFT = 2 * CHUNK_INDEX_BITS;
+
+// Every thread makes one failed claim per run at most, leave room for them so
+// the next chunk index never overflows into the number of chunks.
+static const uint64_t MAX_CHUNKS = CHUNK_INDEX_MASK - 65536;
+
+// how many times an idle thread checks for a new run busy waiting, then
+// yielding the CPU to others and finally before going to sleep
+static const int SPIN_COUNT = 1 << 10;
+static const int YIELD_COUNT = 1 << 12;
+
+static inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+static inline uint64_t
+run_of(uint64_t state)
+{
+    return state >> RUN_SHIFT;
+}
+
+ScanScheduler::ScanScheduler(int threads_num_, size_t chunk_size_)
+    : threads_num(threads_num_)
+    , chunk_size(chunk_size_)
+    , job(NULL)
+    , range_begin(0)
+    , range_end(0)
+    , chunk_size_of_run(chunk_size_)
+    , state(0)
+    , done(0)
+    , stop(false)
+    , sleeping(0)
+{
+    for (int i = 1; i < threads_num; i++) {
+        workers.emplace_back(&ScanScheduler::worker_loop, this, i);
+    }
+}
+
+ScanScheduler::~ScanScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    condvar.notify_all();
+
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+void
+ScanScheduler::run(size_t begin, size_t end, const Job& job_)
+{
+    if (begin >= end) {
+        return;
+    }
+
+    size_t size = chunk_size;
+    size_t base = begin / size * size;
+
+    while ((end - base + size - 1) / size > MAX_CHUNKS) {
+        size *= 2;
+        base = begin / size * size;
+    }
+
+    uint64_t chunks = (end - base + size - 1) / size;
+
+    if (threads_num == 1 || chunks == 1) {
+        job_(0, begin, end);
+        return;
+    }
+
+    job = &job_;
+    range_begin = begin;
+    range_end = end;
+    chunk_size_of_run = size;
+
+    done.store(0, std::memory_order_relaxed);
+
+    uint64_t next_run = run_of(state.load(std::memory_order_relaxed)) + 1;
+    state.store((next_run << RUN_SHIFT) | (chunks << CHUNK_INDEX_BITS), std::memory_order_seq_cst);
+
+    if (sleeping.load(std::memory_order_seq_cst) > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        condvar.notify_all();
+    }
+
+    work(0);
+
+    for (int spins = 0; done.load(std::memory_order_acquire) < chunks; spins++) {
+        if (spins < SPIN_COUNT) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void
+ScanScheduler::work(int worker)
+{
+    for (;;) {
+        uint64_t s = state.fetch_add(1, std::memory_order_acq_rel);
+        uint64_t index = s & CHUNK_INDEX_MASK;
+        uint64_t chunks = (s >> CHUNK_INDEX_BITS) & CHUNK_INDEX_MASK;
+
+        if (index >= chunks) {
+            break;
+        }
+
+        // the chunk is claimed, so parameters of its run stay intact until we
+        // report it as done
+        size_t size = chunk_size_of_run;
+        size_t base = range_begin / size * size;
+        size_t begin = std::max(range_begin, base + index * size);
+        size_t end = std::min(range_end, base + (index + 1) * size);
+
+        (*job)(worker, begin, end);
+
+        done.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void
+ScanScheduler::worker_loop(int worker)
+{
+    uint64_t seen_run = 0;
+
+    for (;;) {
+        int spins = 0;
+
+        while (run_of(state.load(std::memory_order_acquire)) == seen_run && !stop) {
+            if (++spins < SPIN_COUNT) {
+                cpu_relax();
+                continue;
+            }
+
+            if (spins < SPIN_COUNT + YIELD_COUNT) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+
+            sleeping++;
+            condvar.wait(lock, [&] { return stop || run_of(state.load(std::memory_order_seq_cst)) != seen_run; });
+            sleeping--;
+        }
+
+        if (stop) {
+            break;
+        }
+
+        seen_run = run_of(state.load(std::memory_order_acquire));
+        work(worker);
+    }
+}
+
+} // namespace imgdupl
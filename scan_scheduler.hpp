@@ -0,0 +1,76 @@
+#ifndef __SCAN_SCHEDULER_HPP_INCLUDED__
+#define __SCAN_SCHEDULER_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace imgdupl
+{
+
+// Runs a job over a range of indexes with a set of persistent threads. The
+// range is cut into chunks which threads claim one by one from a shared atomic
+// counter, so a thread which is done with its chunk takes the next unclaimed
+// one instead of waiting for others. The calling thread takes part in the work
+// too, completion is tracked with an atomic counter of finished chunks and no
+// locks are taken unless idle threads went to sleep.
+class ScanScheduler
+{
+public:
+    // Job gets an index of a thread (0 ... threads() - 1) and a chunk of the range.
+    typedef std::function<void(int worker, size_t begin, size_t end)> Job;
+
+    // threads_num is the total number of threads, including the calling one.
+    // Chunk boundaries are multiples of chunk_size, except for the range ends.
+    ScanScheduler(int threads_num, size_t chunk_size);
+    ~ScanScheduler();
+
+    int threads() const
+    {
+        return threads_num;
+    }
+
+    // Runs job over [begin, end) and returns when all chunks are processed.
+    // Ranges which fit in a single chunk are processed by the calling thread
+    // alone, without waking others up.
+    void run(size_t begin, size_t end, const Job& job);
+
+    ScanScheduler(ScanScheduler const&) = delete;
+    ScanScheduler& operator=(ScanScheduler const&) = delete;
+
+private:
+    int threads_num;
+    size_t chunk_size;
+
+    // parameters of the current run, they are published by a release store to
+    // the state and don't change until all chunks are processed
+    const Job* job;
+    size_t range_begin;
+    size_t range_end;
+    size_t chunk_size_of_run;
+
+    // run number, number of chunks and the next chunk to claim packed in a
+    // single word so a thread learns everything with one atomic operation
+    std::atomic<uint64_t> state;
+    std::atomic<size_t> done;
+
+    std::atomic<bool> stop;
+    std::atomic<int> sleeping;
+    std::mutex mutex;
+    std::condition_variable condvar;
+
+    std::vector<std::thread> workers;
+
+    void worker_loop(int worker);
+    void work(int worker);
+};
+
+} // namespace imgdupl
+
+#endif
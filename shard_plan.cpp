@@ -0,0 +1,83 @@
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "shard_plan.hpp"
+#include "exc.hpp"
+
+namespace imgdupl
+{
+
+ShardPlan::ShardPlan(int shard_, int shards_)
+    : shard_num(shard_)
+    , shards_num(shards_)
+    , blocks_num(1)
+{
+    THROW_EXC_IF_FAILED(shards_num > 0 && shard_num >= 0 && shard_num < shards_num, "invalid shard %i of %i", shard_num,
+        shards_num);
+
+    // Work of all tasks is blocks^2, with more blocks tasks are smaller and
+    // easier to balance, but every one of them builds an index of its own.
+    // The smallest number of blocks which keeps every shard within
+    // MAX_IMBALANCE_PERCENT of the mean is used.
+    Assignment assignment;
+
+    for (;; blocks_num++) {
+        assign_tasks(assignment);
+
+        size_t max_load = *std::max_element(loads.begin(), loads.end());
+        size_t min_load = *std::min_element(loads.begin(), loads.end());
+
+        if (min_load > 0 && max_load * shards_num * 100 <= total_load() * (100 + MAX_IMBALANCE_PERCENT)) {
+            break;
+        }
+    }
+
+    for (auto& t : assignment) {
+        if (t.first == shard_num) {
+            shard_tasks.push_back(t.second);
+        }
+    }
+}
+
+void
+ShardPlan::assign_tasks(Assignment& assignment)
+{
+    std::vector<std::pair<size_t, size_t>> tasks;
+
+    // the most expensive tasks go first, so the cheap ones even loads out
+    for (size_t a = 0; a < blocks_num; a++) {
+        for (size_t b = a + 1; b < blocks_num; b++) {
+            tasks.push_back(std::make_pair(a, b));
+        }
+    }
+    for (size_t a = 0; a < blocks_num; a++) {
+        tasks.push_back(std::make_pair(a, a));
+    }
+
+    loads.assign(shards_num, 0);
+    assignment.clear();
+
+    // every task goes to the least loaded shard, the first one of them if
+    // there are several, so all processes come up with the same plan
+    for (auto& t : tasks) {
+        int shard = std::min_element(loads.begin(), loads.end()) - loads.begin();
+
+        loads[shard] += task_load(t);
+        assignment.push_back(std::make_pair(shard, t));
+    }
+}
+
+ShardPlan
+ShardPlan::parse(const std::string& spec)
+{
+    int shard, shards, consumed = 0;
+
+    int rc = sscanf(spec.c_str(), "%i/%i%n", &shard, &shards, &consumed);
+    THROW_EXC_IF_FAILED(rc == 2 && static_cast<size_t>(consumed) == spec.size(),
+        "invalid shard '%s', must be K/N where K is 0 ... N - 1", spec.c_str());
+
+    return ShardPlan(shard, shards);
+}
+
+} // namespace imgdupl
@@ -0,0 +1,93 @@
+#ifndef __SHARD_PLAN_HPP_INCLUDED__
+#define __SHARD_PLAN_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace imgdupl
+{
+
+// Splits clusterization into shards which independent processes run on any
+// node. Images are put into blocks by their ids, a task compares every image
+// of one block with every image of another one (or of the same block) and
+// tasks of all pairs of blocks are distributed between shards so that they
+// get about the same work. Every pair of images is compared by exactly one
+// shard, so merging connected components of all shards gives the same result
+// as a single process would.
+class ShardPlan
+{
+public:
+    // shard is 0 ... shards - 1
+    ShardPlan(int shard, int shards);
+
+    // Parses "K/N", K is 0 ... N - 1, throws if it's malformed.
+    static ShardPlan parse(const std::string& spec);
+
+    int shard() const
+    {
+        return shard_num;
+    }
+
+    int shards() const
+    {
+        return shards_num;
+    }
+
+    size_t blocks() const
+    {
+        return blocks_num;
+    }
+
+    size_t block_of(uint32_t image_id) const
+    {
+        return image_id % blocks_num;
+    }
+
+    // pairs of blocks (a <= b) this shard compares
+    const std::vector<std::pair<size_t, size_t>>& tasks() const
+    {
+        return shard_tasks;
+    }
+
+    // Work of a task in halves of comparing two different blocks, a block
+    // compared with itself takes half of the pairs.
+    static size_t task_load(const std::pair<size_t, size_t>& task)
+    {
+        return task.first == task.second ? 1 : 2;
+    }
+
+    // work of a shard, see task_load()
+    size_t load(int shard) const
+    {
+        return loads[shard];
+    }
+
+    size_t total_load() const
+    {
+        return blocks_num * blocks_num;
+    }
+
+    // the most a shard may do over the mean work of shards
+    static const size_t MAX_IMBALANCE_PERCENT = 10;
+
+private:
+    int shard_num;
+    int shards_num;
+    size_t blocks_num;
+    std::vector<std::pair<size_t, size_t>> shard_tasks;
+    std::vector<size_t> loads;
+
+    typedef std::vector<std::pair<int, std::pair<size_t, size_t>>> Assignment;
+
+    // Deals tasks of blocks_num blocks out to shards, fills in (shard, task)
+    // for every task and loads of shards.
+    void assign_tasks(Assignment& assignment);
+};
+
+} // namespace imgdupl
+
+#endif
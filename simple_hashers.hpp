@@ -0,0 +1,119 @@
+#ifndef __SIMPLE_HASHERS_HPP_INCLUDED__
+#define __SIMPLE_HASHERS_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <Magick++.h>
+
+#include "phash.hpp"
+
+namespace imgdupl
+{
+
+// Resizes the image in place to width x height pixels ignoring its aspect
+// ratio, converts it to grayscale, so CMYK images are turned into RGB first,
+// and exports intensities, rows one after another.
+inline void
+load_intensities(Magick::Image& image, int width, int height, float* pixels)
+{
+    Magick::Geometry geometry(width, height);
+    geometry.aspect(true);
+
+    image.transform(geometry);
+    image.type(Magick::GrayscaleType);
+
+    image.write(0, 0, width, height, "I", Magick::FloatPixel, pixels);
+}
+
+// Average hash: an image is downscaled to Side x Side pixels, a bit is set if
+// its pixel is brighter than the mean of all of them. Much cheaper than the
+// DCT hash, but it's less robust to changes of contrast and gamma.
+template <int Side>
+class AverageHasher
+{
+public:
+    // side of a square image a hash is calculated on
+    static const int size = Side;
+    static const int bits = Side * Side;
+
+    // pixels of an image in hash_batch() input
+    static const int pixels = Side * Side;
+
+    typedef BasicPHash<bits> Hash;
+
+    template <typename Pixel>
+    void hash_batch(const Pixel* p, size_t count, Hash* hashes) const
+    {
+        for (size_t k = 0; k < count; k++, p += pixels) {
+            float mean = 0;
+            for (int i = 0; i < pixels; i++) {
+                mean += p[i];
+            }
+            mean /= pixels;
+
+            Hash phash {};
+            for (int i = 0; i < pixels; i++) {
+                if (p[i] > mean) {
+                    phash[i / 64] |= uint64_t(1) << (i % 64);
+                }
+            }
+
+            hashes[k] = phash;
+        }
+    }
+
+    // Converts an image into pixels for hash_batch(), resizes it in place.
+    static void load_pixels(Magick::Image& image, float* p)
+    {
+        load_intensities(image, Side, Side, p);
+    }
+};
+
+// Difference hash: an image is downscaled to (Side + 1) x Side pixels, a bit
+// is set if a pixel is brighter than its right neighbour. As cheap as the
+// average hash and tolerates changes of brightness and contrast.
+template <int Side>
+class DifferenceHasher
+{
+public:
+    // Size hint for decoders only: images are downscaled to (Side + 1) x Side
+    // pixels, one column more than bits in a row.
+    static const int size = Side;
+    static const int bits = Side * Side;
+
+    // pixels of an image in hash_batch() input
+    static const int pixels = (Side + 1) * Side;
+
+    typedef BasicPHash<bits> Hash;
+
+    template <typename Pixel>
+    void hash_batch(const Pixel* p, size_t count, Hash* hashes) const
+    {
+        for (size_t k = 0; k < count; k++, p += pixels) {
+            Hash phash {};
+
+            for (int row = 0; row < Side; row++) {
+                const Pixel* r = p + row * (Side + 1);
+
+                for (int col = 0; col < Side; col++) {
+                    if (r[col] > r[col + 1]) {
+                        int i = row * Side + col;
+                        phash[i / 64] |= uint64_t(1) << (i % 64);
+                    }
+                }
+            }
+
+            hashes[k] = phash;
+        }
+    }
+
+    static void load_pixels(Magick::Image& image, float* p)
+    {
+        load_intensities(image, Side + 1, Side, p);
+    }
+};
+
+} // namespace imgdupl
+
+#endif
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+
+#include <iostream>
+#include <vector>
+
+#include "shard_plan.hpp"
+
+using namespace imgdupl;
+
+// Checks plans of 1 ... 8 shards: every pair of blocks is compared by exactly
+// one shard and no shard gets more than its share of work plus
+// ShardPlan::MAX_IMBALANCE_PERCENT.
+static bool
+check_plan(int shards)
+{
+    size_t blocks = ShardPlan(0, shards).blocks();
+    std::vector<std::vector<int>> compared(blocks, std::vector<int>(blocks, 0));
+    bool ok = true;
+
+    std::cout << shards << " shards, " << blocks << " blocks, loads:";
+
+    for (int k = 0; k < shards; k++) {
+        ShardPlan plan(k, shards);
+        size_t load = 0;
+
+        for (auto& t : plan.tasks()) {
+            compared[t.first][t.second]++;
+            load += ShardPlan::task_load(t);
+        }
+
+        std::cout << " " << load;
+
+        if (plan.blocks() != blocks || load != plan.load(k) || load == 0
+            || load * shards * 100 > plan.total_load() * (100 + ShardPlan::MAX_IMBALANCE_PERCENT)) {
+            ok = false;
+        }
+    }
+
+    std::cout << std::endl;
+
+    for (size_t a = 0; a < blocks; a++) {
+        for (size_t b = a; b < blocks; b++) {
+            if (compared[a][b] != 1) {
+                std::cout << "blocks " << a << " and " << b << " are compared " << compared[a][b] << " times"
+                          << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+int
+main()
+{
+    bool ok = true;
+
+    for (int shards = 1; shards <= 8; shards++) {
+        ok = check_plan(shards) && ok;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
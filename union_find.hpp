@@ -0,0 +1,145 @@
+#ifndef __UNION_FIND_HPP_INCLUDED__
+#define __UNION_FIND_HPP_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+
+namespace imgdupl
+{
+
+// Disjoint sets of elements 0 ... n - 1. A set is represented by its smallest
+// element, so representatives don't depend on the order sets were merged in.
+class UnionFind
+{
+public:
+    UnionFind(size_t n = 0)
+    {
+        resize(n);
+    }
+
+    size_t size() const
+    {
+        return parents.size();
+    }
+
+    // Adds elements size() ... n - 1, each in a set of its own.
+    void resize(size_t n)
+    {
+        for (size_t i = parents.size(); i < n; i++) {
+            parents.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    uint32_t find(uint32_t v)
+    {
+        // path halving
+        while (parents[v] != v) {
+            parents[v] = parents[parents[v]];
+            v = parents[v];
+        }
+
+        return v;
+    }
+
+    // false if a and b were in the same set already
+    bool unite(uint32_t a, uint32_t b)
+    {
+        a = find(a);
+        b = find(b);
+
+        if (a == b) {
+            return false;
+        }
+
+        if (a > b) {
+            std::swap(a, b);
+        }
+
+        parents[b] = a;
+
+        return true;
+    }
+
+private:
+    std::vector<uint32_t> parents;
+};
+
+// UnionFind which threads can change concurrently without locks. A root is
+// linked to another one with a compare and swap, which fails if someone has
+// linked it first, then both roots are looked up again. Links always go from
+// a larger element to a smaller one, so parents never form a cycle and a set
+// is represented by its smallest element here too.
+class ConcurrentUnionFind
+{
+public:
+    ConcurrentUnionFind(size_t n)
+        : count(n)
+        , parents(new std::atomic<uint32_t>[n])
+    {
+        for (size_t i = 0; i < n; i++) {
+            parents[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+        }
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    uint32_t find(uint32_t v)
+    {
+        for (;;) {
+            uint32_t p = parents[v].load(std::memory_order_relaxed);
+            if (p == v) {
+                return v;
+            }
+
+            // path halving, it's fine to lose the race, the grandparent is
+            // in the same set anyway
+            uint32_t gp = parents[p].load(std::memory_order_relaxed);
+            if (gp != p) {
+                parents[v].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+            }
+
+            v = gp;
+        }
+    }
+
+    // false if a and b were in the same set already
+    bool unite(uint32_t a, uint32_t b)
+    {
+        for (;;) {
+            a = find(a);
+            b = find(b);
+
+            if (a == b) {
+                return false;
+            }
+
+            if (a > b) {
+                std::swap(a, b);
+            }
+
+            uint32_t expected = b;
+            if (parents[b].compare_exchange_strong(expected, a, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+    }
+
+    ConcurrentUnionFind(ConcurrentUnionFind const&) = delete;
+    ConcurrentUnionFind& operator=(ConcurrentUnionFind const&) = delete;
+
+private:
+    size_t count;
+    std::unique_ptr<std::atomic<uint32_t>[]> parents;
+};
+
+} // namespace imgdupl
+
+#endif